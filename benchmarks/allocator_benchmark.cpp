@@ -0,0 +1,540 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <thread>
+#include <memory_resource>
+
+#include "bitmap_linear.h"
+#include "../lockfree/memPool/bitmap.h"
+#include "../lockfree/memPool/queue.h"
+#include "../lockfree/memPool/fixed_pool.h"
+#include "perf_counter.h"
+
+using nanosec = std::chrono::duration<double, std::nano>;
+
+/*
+* Fills the bitmap up to given level with randomly placed holes
+* and measures one allocation (and release of the same slot)
+* with the sequential hint, as PoolAllocator uses it.
+*/
+template <typename Bitmap>
+double allocationCost(size_t size, double fill, size_t operations) {
+	Bitmap bitmap(size);
+	std::vector<size_t> taken(size);
+	for (size_t i = 0; i < size; ++i)
+		taken[i] = bitmap.acquire(i);
+
+	std::shuffle(taken.begin(), taken.end(), std::default_random_engine(size));
+	size_t holes = std::max<size_t>(1, static_cast<size_t>(size * (1 - fill)));
+	for (size_t i = 0; i < holes; ++i)
+		bitmap.release(taken[i]);
+
+	size_t hint = 0;
+	auto begin = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < operations; ++i) {
+		size_t index = bitmap.acquire(hint);
+		hint += 1;
+		bitmap.release(index);
+	}
+	auto end = std::chrono::steady_clock::now();
+	return nanosec(end - begin).count() / operations;
+}
+
+void fillLevels() {
+	const double levels[] = {0.0, 0.5, 0.9, 0.99, 0.999, 1.0};
+
+	std::cout << "Allocation cost [ns] vs. fill level (linear / hierarchical)" << std::endl;
+	std::cout << std::setw(10) << "slots";
+	for (double level : levels)
+		std::cout << std::setw(22) << level * 100;
+	std::cout << std::endl;
+
+	for (size_t shift = 11; shift <= 22; ++shift) {
+		size_t size = size_t(1) << shift;
+		std::cout << std::setw(10) << size;
+		for (double level : levels) {
+			//the linear search is too slow to repeat it often on full pool
+			size_t operations = std::max<size_t>(20, 20000 * (1 - level));
+			double flat = allocationCost<linear::Bitmap>(size, level, operations);
+			double tree = allocationCost<lockfree::memPool::Bitmap>(size, level, operations);
+			std::cout << std::setw(12) << std::fixed << std::setprecision(1) << flat
+			          << " / " << std::setw(7) << tree;
+		}
+		std::cout << std::endl;
+	}
+}
+
+template <typename Duration>
+double elapsed(std::chrono::steady_clock::time_point begin) {
+	return Duration(std::chrono::steady_clock::now() - begin).count();
+}
+
+using millisec = std::chrono::duration<double, std::milli>;
+
+/*
+* Construction of the queue, the first push into it, and the cost
+* of initializing the whole pool ahead by prefault with 1 and 4 threads
+* (which is what the construction used to cost).
+*/
+template <size_t Size>
+void initializationCost() {
+	using Queue = lockfree::memPool::Queue<size_t, Size>;
+	auto begin = std::chrono::steady_clock::now();
+	std::unique_ptr<Queue> queue(new Queue());
+	double construct = elapsed<millisec>(begin);
+	begin = std::chrono::steady_clock::now();
+	queue->push(1);
+	double push = elapsed<nanosec>(begin);
+
+	queue.reset(new Queue());
+	begin = std::chrono::steady_clock::now();
+	queue->prefault(1);
+	double serial = elapsed<millisec>(begin);
+
+	queue.reset(new Queue());
+	begin = std::chrono::steady_clock::now();
+	queue->prefault(4);
+	double parallel = elapsed<millisec>(begin);
+
+	std::cout << std::setw(10) << Size << std::fixed << std::setprecision(2)
+	          << std::setw(16) << construct << std::setw(16) << push
+	          << std::setw(16) << serial << std::setw(16) << parallel << std::endl;
+}
+
+template <size_t... Shifts>
+void initializationCosts(std::index_sequence<Shifts...>) {
+	std::cout << "Pool initialization" << std::endl;
+	std::cout << std::setw(10) << "slots" << std::setw(16) << "construct [ms]"
+	          << std::setw(16) << "1st push [ns]" << std::setw(16) << "prefault [ms]"
+	          << std::setw(16) << "prefault 4 [ms]" << std::endl;
+	int expand[] = {(initializationCost<size_t(1) << (Shifts + 17)>(), 0)...};
+	(void) expand;
+}
+
+/*
+* Keeps half of a big pool occupied and measures push + pop pairs,
+* which walk through the whole pool, together with dTLB read misses.
+*/
+template <typename Backing>
+void pageCost(const char *name) {
+	const size_t size = size_t(1) << 22;
+	const size_t operations = size * 2;
+	using Queue = lockfree::memPool::Queue<size_t, size, Backing>;
+	std::unique_ptr<Queue> queue(new Queue());
+	queue->prefault();
+	for (size_t i = 0; i < size / 2; ++i)
+		queue->push(i);
+
+	PerfCounter misses = PerfCounter::dTLBMisses();
+	size_t value;
+	misses.start();
+	auto begin = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < operations; ++i) {
+		queue->push(i);
+		queue->pop(value);
+	}
+	double time = elapsed<nanosec>(begin);
+	uint64_t count = misses.stop();
+
+	std::cout << std::setw(24) << name << std::fixed << std::setprecision(2)
+	          << std::setw(16) << operations * 1e3 / time;
+	if (misses.valid())
+		std::cout << std::setw(20) << double(count) / operations;
+	else
+		std::cout << std::setw(20) << "n/a";
+	std::cout << std::endl;
+}
+
+void pageCosts() {
+	using namespace lockfree::memPool;
+	std::cout << "Pool backing (4M slots, half full)" << std::endl;
+	std::cout << std::setw(24) << "backing" << std::setw(16) << "Mops/s"
+	          << std::setw(20) << "dTLB misses / op" << std::endl;
+	pageCost<policy::Heap>("std::allocator");
+	pageCost<policy::HugePages<>>("transparent huge pages");
+	pageCost<policy::HugePages<Pages::explicit_>>("MAP_HUGETLB");
+}
+
+/*
+* Amortized cost of one slot obtained and returned by allocate_n and
+* deallocate_n with the given batch size, compared with allocate and
+* deallocate of single slots, in a half full pool.
+*/
+void batchCost(size_t batch) {
+	using Pool = lockfree::memPool::Queue<size_t>::Pool;
+	const size_t size = size_t(1) << 16;
+	const size_t slots = size_t(1) << 20;
+	Pool pool(size);
+	for (size_t i = 0; i < size / 2; ++i)
+		pool.allocate();
+
+	size_t indices[64];
+	size_t done = 0;
+	auto begin = std::chrono::steady_clock::now();
+	while (done < slots) {
+		size_t count = pool.allocate_n(batch, indices);
+		pool.deallocate_n(indices, count);
+		done += count;
+	}
+	double bulk = elapsed<nanosec>(begin) / done;
+
+	begin = std::chrono::steady_clock::now();
+	for (done = 0; done < slots; done += batch) {
+		for (size_t i = 0; i < batch; ++i)
+			indices[i] = pool.allocate();
+		for (size_t i = 0; i < batch; ++i)
+			pool.deallocate(indices[i]);
+	}
+	double single = elapsed<nanosec>(begin) / done;
+
+	std::cout << std::setw(10) << batch << std::fixed << std::setprecision(2)
+	          << std::setw(16) << bulk << std::setw(16) << single << std::endl;
+}
+
+void batchCosts() {
+	std::cout << "Slot cost [ns] by batch size" << std::endl;
+	std::cout << std::setw(10) << "batch" << std::setw(16) << "allocate_n"
+	          << std::setw(16) << "allocate" << std::endl;
+	for (size_t batch = 1; batch <= 64; batch *= 2)
+		batchCost(batch);
+}
+
+/*
+* Threads push and pop pairs on one queue, which keeps a quarter
+* of the pool occupied. Reports throughput and cache misses per pair
+* for the given hint policy.
+*/
+template <typename Hint>
+void affinityCost(const char *name, size_t threads) {
+	const size_t size = size_t(1) << 16;
+	const size_t operations = size_t(1) << 18;
+	using Queue = lockfree::memPool::Queue<size_t, size, Hint>;
+	std::unique_ptr<Queue> queue(new Queue());
+	for (size_t i = 0; i < size / 4; ++i)
+		queue->push(i);
+
+	PerfCounter misses = PerfCounter::cacheMisses();
+	misses.start();
+	auto begin = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; ++t) {
+		workers.emplace_back([&queue, operations, threads] {
+			size_t value;
+			for (size_t i = 0; i < operations / threads; ++i) {
+				while (!queue->push(i)) {}
+				queue->pop(value);
+			}
+		});
+	}
+	for (auto& worker : workers)
+		worker.join();
+	double time = elapsed<nanosec>(begin);
+	uint64_t count = misses.stop();
+
+	std::cout << std::setw(20) << name << std::setw(10) << threads << std::fixed << std::setprecision(2)
+	          << std::setw(16) << operations * 1e3 / time;
+	if (misses.valid())
+		std::cout << std::setw(24) << double(count) / operations;
+	else
+		std::cout << std::setw(24) << "n/a";
+	std::cout << std::endl;
+}
+
+void affinityCosts() {
+	using namespace lockfree::memPool;
+	std::cout << "Thread affine regions (64K slots, a quarter full)" << std::endl;
+	std::cout << std::setw(20) << "hint" << std::setw(10) << "threads" << std::setw(16) << "Mpairs/s"
+	          << std::setw(24) << "cache misses / pair" << std::endl;
+	for (size_t threads = 1; threads <= 8; threads *= 2) {
+		affinityCost<policy::SequentialHint>("sequential", threads);
+		affinityCost<policy::AffineHint<>>("affine", threads);
+	}
+}
+
+/*
+* Every thread allocates and releases a slot in its own bitmap word,
+* so the threads share only cache lines the layout puts them in.
+* Returns nanoseconds per operation of one thread.
+*/
+template <typename Layout>
+double contentionCost(size_t threads) {
+	const size_t size = 64 * 512;
+	const size_t operations = 200000;
+	lockfree::memPool::BasicBitmap<Layout> bitmap(size);
+	auto begin = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; ++t) {
+		workers.emplace_back([&bitmap, t, operations] {
+			for (size_t i = 0; i < operations; ++i)
+				bitmap.release(bitmap.acquire(t * 64 + i % 64));
+		});
+	}
+	for (auto& worker : workers)
+		worker.join();
+	return elapsed<nanosec>(begin) / operations;
+}
+
+void contentionCosts() {
+	using namespace lockfree::memPool;
+	const size_t words = 512;
+	std::cout << "Flag layout under contention [ns per operation of a thread]" << std::endl;
+	std::cout << std::setw(10) << "threads" << std::setw(14) << "packed"
+	          << std::setw(14) << "padded" << std::setw(14) << "padded 4"
+	          << std::setw(14) << "interleaved" << std::endl;
+	std::cout << std::setw(10) << "bytes" << std::setw(14) << policy::PackedFlags::words(words) * 8
+	          << std::setw(14) << policy::PaddedFlags<>::words(words) * 8
+	          << std::setw(14) << policy::PaddedFlags<4>::words(words) * 8
+	          << std::setw(14) << policy::InterleavedFlags::words(words) * 8 << std::endl;
+	for (size_t threads = 2; threads <= 64; threads *= 2) {
+		std::cout << std::setw(10) << threads << std::fixed << std::setprecision(1)
+		          << std::setw(14) << contentionCost<policy::PackedFlags>(threads)
+		          << std::setw(14) << contentionCost<policy::PaddedFlags<>>(threads)
+		          << std::setw(14) << contentionCost<policy::PaddedFlags<4>>(threads)
+		          << std::setw(14) << contentionCost<policy::InterleavedFlags>(threads) << std::endl;
+	}
+}
+
+// object of the fixed section
+struct Object {
+	size_t values[4];
+};
+
+/*
+* Every thread allocates 64 objects and frees them again, by the given
+* allocate and deallocate functions. Returns nanoseconds per object.
+*/
+template <typename Allocate, typename Deallocate>
+double fixedCost(size_t threads, Allocate allocate, Deallocate deallocate) {
+	const size_t objects = size_t(1) << 20;
+	auto begin = std::chrono::steady_clock::now();
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; ++t) {
+		workers.emplace_back([&allocate, &deallocate, objects, threads] {
+			Object *held[64];
+			for (size_t i = 0; i < objects / threads; i += 64) {
+				for (auto& object : held)
+					object = allocate();
+				for (auto& object : held)
+					deallocate(object);
+			}
+		});
+	}
+	for (auto& worker : workers)
+		worker.join();
+	return elapsed<nanosec>(begin) / objects;
+}
+
+void fixedCosts() {
+	using namespace lockfree::memPool;
+	std::cout << "Single object allocation [ns per object]" << std::endl;
+	std::cout << std::setw(10) << "threads" << std::setw(14) << "new/delete"
+	          << std::setw(14) << "FixedPool" << std::setw(14) << "magazines"
+	          << std::setw(14) << "synchronized" << std::setw(16) << "FixedResource" << std::endl;
+	for (size_t threads = 1; threads <= 8; threads *= 2) {
+		//the objects held at once fill a half of the pools
+		const size_t size = threads * 128;
+		FixedPool<Object> pool(size);
+		FixedPool<Object, policy::Magazines<32>> magazines(size + threads * 32);
+		std::pmr::synchronized_pool_resource synchronized;
+		FixedResource<Object> resource{FixedPool<Object>(size)};
+
+		std::cout << std::setw(10) << threads << std::fixed << std::setprecision(2)
+		          << std::setw(14) << fixedCost(threads, [] { return new Object; },
+		                                        [](Object *p) { delete p; })
+		          << std::setw(14) << fixedCost(threads, [&pool] { return pool.allocate(1); },
+		                                        [&pool](Object *p) { pool.deallocate(p, 1); })
+		          << std::setw(14) << fixedCost(threads, [&magazines] { return magazines.allocate(1); },
+		                                        [&magazines](Object *p) { magazines.deallocate(p, 1); })
+		          << std::setw(14) << fixedCost(threads, [&synchronized] {
+		                                            return static_cast<Object *>(synchronized.allocate(sizeof(Object), alignof(Object)));
+		                                        },
+		                                        [&synchronized](Object *p) { synchronized.deallocate(p, sizeof(Object), alignof(Object)); })
+		          << std::setw(16) << fixedCost(threads, [&resource] {
+		                                            return static_cast<Object *>(resource.allocate(sizeof(Object), alignof(Object)));
+		                                        },
+		                                        [&resource](Object *p) { resource.deallocate(p, sizeof(Object), alignof(Object)); })
+		          << std::endl;
+	}
+}
+
+/*
+* Time to find the first word with a free bit from a random start
+* by every scan implementation, in words with randomly taken bits
+*/
+double scanCost(const std::vector<std::atomic<size_t>>& words, lockfree::memPool::scan::Isa isa) {
+	namespace scan = lockfree::memPool::scan;
+	const size_t searches = 100000;
+	scan::use(isa);
+	std::minstd_rand random(1);
+	size_t sum = 0;
+	auto begin = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < searches; ++i)
+		sum += scan::find(words.data(), random() % words.size(), words.size());
+	double time = elapsed<nanosec>(begin) / searches;
+	//keeps the searches from being optimized out
+	if (sum == 0)
+		std::cout << "";
+	return time;
+}
+
+void scanCosts() {
+	namespace scan = lockfree::memPool::scan;
+	const double levels[] = {0.9, 0.99, 0.999, 0.9999};
+	const scan::Isa isas[] = {scan::Isa::scalar, scan::Isa::sse42, scan::Isa::avx2};
+	std::cout << "Search for a free word [ns] (scan of words / bitmap acquire), best: "
+	          << static_cast<int>(scan::best()) << std::endl;
+	std::cout << std::setw(10) << "slots" << std::setw(8) << "fill" << std::setw(22) << "scalar"
+	          << std::setw(22) << "sse4.2" << std::setw(22) << "avx2" << std::endl;
+	for (size_t shift = 20; shift <= 24; shift += 4) {
+		size_t size = size_t(1) << shift;
+		for (double level : levels) {
+			std::vector<std::atomic<size_t>> words(size / 64);
+			std::bernoulli_distribution taken(level);
+			std::minstd_rand random(shift);
+			for (auto& word : words) {
+				size_t value = 0;
+				for (size_t bit = 0; bit < 64; ++bit)
+					value |= size_t(taken(random)) << bit;
+				word = value;
+			}
+			std::cout << std::setw(10) << size << std::setw(8) << std::setprecision(2)
+			          << std::fixed << level * 100;
+			for (scan::Isa isa : isas) {
+				double raw = scanCost(words, isa);
+				double tree = allocationCost<lockfree::memPool::Bitmap>(size, level, 20000);
+				std::cout << std::setw(12) << std::fixed << std::setprecision(1) << raw
+				          << " / " << std::setw(7) << tree;
+			}
+			std::cout << std::endl;
+		}
+	}
+	scan::use(scan::best());
+}
+
+/*
+* Time to destroy a queue holding all but a few slots of its pool,
+* which it owns or shares with other queues
+*/
+template <typename T, size_t Size>
+void teardownCost(const char *name) {
+	using Queue = lockfree::memPool::Queue<T, Size>;
+	std::unique_ptr<Queue> owning(new Queue());
+	for (size_t i = 0; i + 2 < Size; ++i)
+		owning->push(T());
+	auto begin = std::chrono::steady_clock::now();
+	owning.reset();
+	double owned = elapsed<millisec>(begin);
+
+	typename Queue::Pool pool(Size);
+	std::unique_ptr<Queue> sharing(new Queue(pool));
+	for (size_t i = 0; i + 2 < Size; ++i)
+		sharing->push(T());
+	begin = std::chrono::steady_clock::now();
+	sharing.reset();
+	double shared = elapsed<millisec>(begin);
+
+	std::cout << std::setw(10) << Size << std::setw(14) << name << std::fixed << std::setprecision(2)
+	          << std::setw(14) << owned << std::setw(14) << shared << std::endl;
+}
+
+void teardownCosts() {
+	std::cout << "Destruction of a full queue [ms]" << std::endl;
+	std::cout << std::setw(10) << "slots" << std::setw(14) << "value" << std::setw(14) << "owned pool"
+	          << std::setw(14) << "shared pool" << std::endl;
+	teardownCost<size_t, size_t(1) << 20>("size_t");
+	teardownCost<std::string, size_t(1) << 20>("std::string");
+	teardownCost<size_t, size_t(1) << 22>("size_t");
+	teardownCost<std::string, size_t(1) << 22>("std::string");
+}
+
+/*
+* Threads allocate slots, write into them and look up the node holding
+* the page of every 16th slot (by get_mempolicy), which is local,
+* if it is the node the thread runs on
+*/
+template <typename Hint>
+void numaCost(const char *name, size_t threads) {
+	namespace numa = lockfree::memPool::numa;
+	using Pool = typename lockfree::memPool::Queue<size_t, 64, Hint>::Pool;
+	const size_t size = size_t(1) << 18;
+	const size_t operations = size_t(1) << 16;
+	Pool pool(size);
+	std::atomic<size_t> local(0), remote(0), unknown(0);
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; ++t) {
+		workers.emplace_back([&, threads] {
+			//ring of the held slots, keeps a quarter of the pool occupied
+			const size_t keep = size / 4 / threads, count = operations / threads;
+			std::vector<size_t> held(keep);
+			for (size_t i = 0; i < count; ++i) {
+				size_t index = pool.allocate();
+				*reinterpret_cast<size_t *>(pool.address(index)) = i;
+				//the oldest slot is released
+				if (i >= keep)
+					pool.deallocate(held[i % keep]);
+				held[i % keep] = index;
+				if (i % 16 == 0) {
+					size_t node = numa::nodeOf(pool.address(index));
+					if (node == numa::unknown)
+						++unknown;
+					else if (node == numa::node())
+						++local;
+					else
+						++remote;
+				}
+			}
+			for (size_t i = 0; i < std::min(count, keep); ++i)
+				pool.deallocate(held[i]);
+		});
+	}
+	for (auto& worker : workers)
+		worker.join();
+	std::cout << std::setw(24) << name << std::setw(10) << threads << std::setw(12) << local
+	          << std::setw(12) << remote << std::setw(12) << unknown << std::endl;
+}
+
+void numaCosts() {
+	using namespace lockfree::memPool;
+	std::cout << "NUMA placement (" << numa::nodes() << " nodes), sampled allocations" << std::endl;
+	std::cout << std::setw(24) << "hint" << std::setw(10) << "threads" << std::setw(12) << "local"
+	          << std::setw(12) << "remote" << std::setw(12) << "unknown" << std::endl;
+	size_t cores = std::max<size_t>(2, std::thread::hardware_concurrency());
+	for (size_t threads : {size_t(1), cores}) {
+		numaCost<policy::SequentialHint>("sequential", threads);
+		numaCost<policy::NumaHint<>>("numa, bind", threads);
+		numaCost<policy::NumaHint<policy::Placement::firstTouch>>("numa, first touch", threads);
+	}
+}
+
+/*
+* allocator_benchmarks [fill|init|pages|batch|affinity|contention|fixed|scan|teardown|numa], runs all sections without argument
+*/
+int main(int argc, char **argv) {
+	std::string section = argc > 1 ? argv[1] : "";
+	if (section.empty() || section == "fill")
+		fillLevels();
+	if (section.empty() || section == "init")
+		initializationCosts(std::make_index_sequence<8>());
+	if (section.empty() || section == "pages")
+		pageCosts();
+	if (section.empty() || section == "batch")
+		batchCosts();
+	if (section.empty() || section == "affinity")
+		affinityCosts();
+	if (section.empty() || section == "contention")
+		contentionCosts();
+	if (section.empty() || section == "fixed")
+		fixedCosts();
+	if (section.empty() || section == "scan")
+		scanCosts();
+	if (section.empty() || section == "teardown")
+		teardownCosts();
+	if (section.empty() || section == "numa")
+		numaCosts();
+}
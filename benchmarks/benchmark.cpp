@@ -4,6 +4,8 @@
 #include <thread>
 #include <atomic>
 #include <chrono>
+#include <string>
+#include <ctime>
 
 #include "queue_lock.h"
 #include "../lockfree/memPool/queue.h"
@@ -114,13 +116,321 @@ public:
     }
 };
 
-int main() {
+template <typename Hint>
+void runSizing(const std::string& hint) {
+    using namespace lockfree::memPool;
+    Run<Queue<int, 131072, Hint, policy::NoSizeTracking>> untracked("lockfree MemPool " + hint + ", no size tracking");
+    untracked.run();
+    Run<Queue<int, 131072, Hint, policy::SizeTracking>> tracked("lockfree MemPool " + hint + ", size tracking");
+    tracked.run();
+    Run<Queue<int, 131072, Hint, policy::ShardedSize<>>> sharded("lockfree MemPool " + hint + ", sharded size");
+    sharded.run();
+    Run<Queue<int, 131072, Hint, policy::ShardedSize<64, 32>>> approximate("lockfree MemPool " + hint + ", approximate sharded size");
+    approximate.run();
+}
+
+// cost of the statistics policy and the statistics of a run
+void runStatistics() {
+    using namespace lockfree::memPool;
+    using Queue = lockfree::memPool::Queue<int, 131072, policy::Statistics<>>;
+    Run<Queue> counted("lockfree MemPool statistics");
+    counted.run();
+
+    Queue queue;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&queue] {
+            int value;
+            for (int i = 0; i < 100000; ++i) {
+                while (!queue.push(i)) {}
+                queue.pop(value);
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    auto stats = queue.pool().statistics();
+    std::cout << "Statistics: [ allocations: " << stats.allocations << " failures: " << stats.failures
+              << " collisions: " << stats.collisions << " peak: " << stats.peak << " probes:";
+    for (size_t count : stats.probes)
+        std::cout << " " << count;
+    std::cout << " ]" << std::endl;
+}
+
+// every combination of the allocation hint and size tracking policies
+void runPolicies() {
+    using namespace lockfree::memPool;
+    runSizing<policy::SequentialHint>("sequential hint");
+    runSizing<policy::RandomHint>("random hint");
+    runSizing<policy::AffineHint<>>("affine hint");
+    runSizing<policy::LastFreedHint>("last freed hint");
+    runStatistics();
+}
+
+double cpuTime() {
+    timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return time.tv_sec * 1e3 + time.tv_nsec / 1e6;
+}
+
+/*
+* Producers fill a small pool, which a slow consumer (sleeping 20 us
+* after every pop) empties. Reports wall and CPU time of the process,
+* which is spent mostly by blocked producers.
+*/
+template <bool Wait>
+void runBlocked(const std::string& type) {
+    using Queue = lockfree::memPool::Queue<int, 128>;
+    const int producers = 4;
+    const int items = 2000;
+    Queue queue;
+    double cpu = cpuTime();
+    auto begin = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < producers; ++t) {
+        threads.emplace_back([&queue, items] {
+            for (int i = 0; i < items; ++i) {
+                if (Wait)
+                    queue.push_wait(i);
+                else
+                    while (!queue.push(i)) {}
+            }
+        });
+    }
+    std::thread consumer([&queue, producers, items] {
+        int value;
+        for (int popped = 0; popped < producers * items;) {
+            if (queue.pop(value)) {
+                ++popped;
+                std::this_thread::sleep_for(std::chrono::microseconds(20));
+            }
+        }
+    });
+    for (auto& thread : threads)
+        thread.join();
+    consumer.join();
+
+    std::cout << "Type: " << type << " Result: [ Wall: " << millisec(std::chrono::steady_clock::now() - begin).count()
+              << " ms CPU: " << cpuTime() - cpu << " ms]" << std::endl;
+}
+
+/*
+* A producer pushes its clock every 200 us, so the consumer is idle most
+* of the time. Reports the mean time from the push to the pop (wake-up
+* latency) and wall and CPU time of the process, which is spent mostly
+* by the idle consumer, spinning on pop or sleeping in pop_wait.
+*/
+template <bool Wait>
+void runIdle(const std::string& type) {
+    using Queue = lockfree::memPool::Queue<int64_t, 128>;
+    const int items = 2000;
+    Queue queue;
+    auto now = [] {
+        return int64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    };
+    double cpu = cpuTime();
+    auto begin = std::chrono::steady_clock::now();
+
+    double latency = 0;
+    std::thread consumer([&queue, &latency, &now, items] {
+        int64_t stamp;
+        for (int i = 0; i < items; ++i) {
+            if (Wait)
+                queue.pop_wait(stamp);
+            else
+                while (!queue.pop(stamp)) {}
+            latency += now() - stamp;
+        }
+    });
+    for (int i = 0; i < items; ++i) {
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        queue.push(now());
+    }
+    consumer.join();
+
+    std::cout << "Type: " << type << " Result: [ Latency: " << latency / items / 1000 << " us Wall: "
+              << millisec(std::chrono::steady_clock::now() - begin).count() << " ms CPU: " << cpuTime() - cpu
+              << " ms]" << std::endl;
+}
+
+/*
+* One thread pushes and pops 1 KiB strings, which are copied from
+* a prepared value (push of an lvalue), moved in, or built in the slot.
+*/
+template <typename Push>
+void runPayload(const std::string& type, Push push) {
+    using Queue = lockfree::memPool::Queue<std::string, 4096>;
+    const int items = 200000;
+    Queue queue;
+    const std::string payload(1024, 'x');
+    std::string out;
+    size_t length = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < items; ++i) {
+        push(queue, payload);
+        queue.pop(out);
+        length += out.size();
+    }
+    double time = millisec(std::chrono::steady_clock::now() - begin).count();
+    if (length != size_t(items) * payload.size())
+        std::cerr << "FAIL: payload lost" << std::endl;
+    std::cout << "Type: " << type << " Result: [ In: " << items << " Time: " << time * 1000 / items
+              << " microseconds per item]" << std::endl;
+}
+
+/*
+* Two producers push their items by push_bulk in batches of given size
+* (or one by one by push), two consumers pop them. The memPool queue
+* has room for all items, so no producer waits for a free slot.
+*/
+template <typename Queue>
+void runBulk(const std::string& type, size_t batch) {
+    const int producers = 2, consumers = 2;
+    const size_t items = 262144;
+    Queue queue;
+    std::atomic<size_t> popped(0);
+    auto begin = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < producers; ++t) {
+        threads.emplace_back([&queue, batch, items] {
+            std::vector<int> values(batch, 1);
+            for (size_t done = 0; done < items; done += batch) {
+                if (batch == 1) {
+                    while (!queue.push(1)) {}
+                    continue;
+                }
+                for (size_t pushed = 0; pushed < batch;)
+                    pushed += queue.push_bulk(values.begin() + pushed, values.end());
+            }
+        });
+    }
+    for (int t = 0; t < consumers; ++t) {
+        threads.emplace_back([&queue, &popped, items] {
+            int value;
+            while (popped < producers * items) {
+                if (queue.pop(value))
+                    ++popped;
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    double time = millisec(std::chrono::steady_clock::now() - begin).count();
+    std::cout << "Type: " << type << " Result: [ Batch: " << batch << " In: " << producers * items
+              << " Time: " << time * 1e6 / (producers * items) << " ns per item]" << std::endl;
+}
+
+/*
+* Two consumers drain a queue filled in advance by pop_bulk in batches
+* of given size (or one by one by pop).
+*/
+template <typename Queue>
+void runDrain(const std::string& type, size_t batch) {
+    const int consumers = 2;
+    const size_t items = 524288;
+    Queue queue;
+    for (size_t i = 0; i < items; ++i)
+        queue.push(1);
+    std::atomic<size_t> popped(0);
+    auto begin = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < consumers; ++t) {
+        threads.emplace_back([&queue, &popped, batch] {
+            std::vector<int> values(batch);
+            int value;
+            while (true) {
+                size_t count = batch == 1 ? size_t(queue.pop(value)) : queue.pop_bulk(values.begin(), batch);
+                if (!count)
+                    break;
+                popped += count;
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+    double time = millisec(std::chrono::steady_clock::now() - begin).count();
+    if (popped != items)
+        std::cerr << "FAIL: number of poped is not equal to number of pushed" << std::endl;
+    std::cout << "Type: " << type << " Result: [ Batch: " << batch << " Out: " << items
+              << " Time: " << time * 1e6 / items << " ns per item]" << std::endl;
+}
+
+template <typename Queue>
+void runBulkSizes(const std::string& type) {
+    runBulk<Queue>(type + ", push", 1);
+    for (size_t batch : {8, 64, 512})
+        runBulk<Queue>(type + ", push_bulk", batch);
+    runDrain<Queue>(type + ", pop", 1);
+    for (size_t batch : {8, 64, 512})
+        runDrain<Queue>(type + ", pop_bulk", batch);
+}
+
+/*
+* queue_benchmarks [policies|blocking|idle|payload|bulk] - with the argument
+* only memPool allocation policies, blocked producers, idle consumers,
+* the cost of big payloads, or batched push and pop are compared
+*/
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "policies") {
+        runPolicies();
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "blocking") {
+        runBlocked<false>("lockfree MemPool full, spinning push");
+        runBlocked<true>("lockfree MemPool full, push_wait");
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "idle") {
+        runIdle<false>("lockfree MemPool idle, spinning pop");
+        runIdle<true>("lockfree MemPool idle, pop_wait");
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "payload") {
+        using Queue = lockfree::memPool::Queue<std::string, 4096>;
+        runPayload("lockfree MemPool 1 KiB string, push copy", [](Queue& queue, const std::string& payload) {
+            queue.push(payload);
+        });
+        runPayload("lockfree MemPool 1 KiB string, push move", [](Queue& queue, const std::string& payload) {
+            std::string value(payload);
+            queue.push(std::move(value));
+        });
+        runPayload("lockfree MemPool 1 KiB string, emplace", [](Queue& queue, const std::string& payload) {
+            queue.emplace(payload.size(), 'x');
+        });
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "bulk") {
+        runBulkSizes<lockfree::memPool::Queue<int, 1048576>>("lockfree MemPool");
+        runBulkSizes<lockfree::sharedPtr::Queue<int>>("lockfree SharedPtr");
+        runBulkSizes<lockfree::sharedPtr::Queue<int, lockfree::sharedPtr::Epochs>>("lockfree SharedPtr epochs");
+        return 0;
+    }
     Run<lock::wrapper::Queue<int>> withLock("lock DequeueWrapper");
     withLock.run();
     Run<lock::sharedPtr::Queue<int>> sharedPtrLock("lock SharedPtr");
     sharedPtrLock.run();
     Run<lockfree::sharedPtr::Queue<int>> lockfreeSharedPtr("lockfree SharedPtr");
     lockfreeSharedPtr.run();
+    Run<lockfree::sharedPtr::Queue<int, lockfree::sharedPtr::Epochs>> lockfreeEpochs("lockfree SharedPtr epochs");
+    lockfreeEpochs.run();
     Run<lockfree::memPool::Queue<int, 131072>> memPool("lockfree MemPool");
     memPool.run();
+    Run<lockfree::memPool::Queue<int, 131072, lockfree::memPool::policy::Magazines<32>>> memPoolMagazines("lockfree MemPool magazines");
+    memPoolMagazines.run();
+    Run<lockfree::memPool::Queue<int, 2048, lockfree::memPool::policy::Growth<131072>>> memPoolGrowing("lockfree MemPool growing");
+    memPoolGrowing.run();
+
+    //high slot reuse: small pool, many threads
+    Run<lockfree::memPool::Queue<int, 128>, 500, 8, 8, 5> churnPointers("lockfree MemPool churn, tagged pointers");
+    churnPointers.run();
+    Run<lockfree::memPool::Queue<int, 128, lockfree::memPool::policy::Handles>, 500, 8, 8, 5> churnHandles("lockfree MemPool churn, handles");
+    churnHandles.run();
+    Run<lockfree::memPool::Queue<int, 128, lockfree::memPool::policy::HazardPointers<>>, 500, 8, 8, 5> churnHazard("lockfree MemPool churn, hazard pointers");
+    churnHazard.run();
+    Run<lockfree::memPool::Queue<int, 128, lockfree::memPool::policy::Epochs>, 500, 8, 8, 5> churnEpochs("lockfree MemPool churn, epochs");
+    churnEpochs.run();
 }
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+namespace linear {
+
+/*
+* The original flat bitmap of PoolAllocator, kept for comparison:
+* the search walks the words from the hint and issues fetch_or
+* on every bit until it wins a free one.
+*/
+struct Bitmap {
+	static constexpr size_t bits = sizeof(size_t) * 8;
+	static constexpr size_t npos = ~size_t(0);
+
+	explicit Bitmap(size_t size) : _size(size),
+	                               _chunks(size / bits),
+	                               _flags(new std::atomic<size_t>[size / bits]) {
+		for (size_t i = 0; i < _chunks; ++i)
+			_flags[i] = 0;
+	}
+
+	size_t acquire(size_t hint) {
+		hint %= _size;
+		size_t chunkOfft = hint / bits;
+		for (size_t i = chunkOfft; i < _chunks + chunkOfft; ++i) {
+			size_t chunk = i % _chunks;
+			size_t position = hint % bits;
+			size_t value = size_t(1) << position;
+			hint = 0; //next round continue with position 0
+			while (position < bits) {
+				auto previous = _flags[chunk].fetch_or(value);
+				if (previous & value) {
+					value <<= 1;
+					++position;
+				} else {
+					return chunk * bits + position;
+				}
+			}
+		}
+		return npos;
+	}
+
+	void release(size_t index) {
+		_flags[index / bits] &= ~(size_t(1) << (index % bits));
+	}
+
+private:
+	size_t _size;
+	size_t _chunks;
+	std::unique_ptr<std::atomic<size_t>[]> _flags;
+};
+
+} //namespace linear
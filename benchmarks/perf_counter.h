@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/*
+* Hardware event counter of the calling thread (and threads it starts
+* afterwards), counted in user space only. If the kernel does not allow
+* the counter (e.g. in a container), valid() is false and read() returns 0.
+*/
+class PerfCounter {
+public:
+	PerfCounter(uint32_t type, uint64_t config) {
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		_fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+	}
+
+	static PerfCounter cache(uint64_t cache, uint64_t result) {
+		return PerfCounter(PERF_TYPE_HW_CACHE,
+		                   cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16));
+	}
+
+	static PerfCounter dTLBMisses() {
+		return cache(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS);
+	}
+
+	static PerfCounter cacheMisses() {
+		return PerfCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	}
+
+	PerfCounter(const PerfCounter&) = delete;
+	PerfCounter& operator=(const PerfCounter&) = delete;
+
+	PerfCounter(PerfCounter&& other) : _fd(other._fd) {
+		other._fd = -1;
+	}
+
+	~PerfCounter() {
+		if (valid())
+			close(_fd);
+	}
+
+	bool valid() const {
+		return _fd >= 0;
+	}
+
+	void start() {
+		if (valid()) {
+			ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+
+	uint64_t stop() {
+		uint64_t count = 0;
+		if (valid()) {
+			ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (::read(_fd, &count, sizeof(count)) != sizeof(count))
+				count = 0;
+		}
+		return count;
+	}
+
+private:
+	int _fd;
+};
@@ -0,0 +1,73 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "../lockfree/reclamation/hazard.h"
+
+using nanosec = std::chrono::duration<double, std::nano>;
+
+void noReclaim(void *, uintptr_t) {}
+
+/*
+* Cost of retiring (and amortized scanning) with given number of threads,
+* which hold hazard pointers. Every thread but the measured one keeps
+* two addresses published, the measured thread retires objects, that are
+* never protected, so every scan reclaims its whole list.
+*/
+template <size_t Threshold>
+void scanCost(size_t threads, size_t operations) {
+	lockfree::hazard::Domain<2> domain(Threshold);
+	std::atomic<bool> done(false);
+	std::atomic<size_t> ready(0);
+	std::vector<int> objects(2 * threads);
+	std::vector<std::thread> holders;
+
+	for (size_t i = 1; i < threads; ++i) {
+		holders.emplace_back([&, i] {
+			typename lockfree::hazard::Domain<2>::Guard guard(domain);
+			guard.protect(0, &objects[2 * i]);
+			guard.protect(1, &objects[2 * i + 1]);
+			++ready;
+			while (!done) {
+				std::this_thread::yield();
+			}
+		});
+	}
+	while (ready != threads - 1) {
+		std::this_thread::yield();
+	}
+
+	int retired;
+	auto begin = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < operations; ++i) {
+		typename lockfree::hazard::Domain<2>::Guard guard(domain);
+		domain.retire(guard, &retired + (i % 2), 0, nullptr, &noReclaim);
+	}
+	auto end = std::chrono::steady_clock::now();
+	size_t scans = domain.scans();
+
+	done = true;
+	for (auto &holder : holders) {
+		holder.join();
+	}
+
+	double total = nanosec(end - begin).count();
+	std::cout << std::setw(8) << threads << std::setw(10) << Threshold
+	          << std::setw(16) << std::fixed << std::setprecision(1) << total / operations
+	          << std::setw(12) << scans << std::endl;
+}
+
+int main() {
+	const size_t operations = 200000;
+	std::cout << "Hazard pointers: retire cost with amortized scan" << std::endl;
+	std::cout << std::setw(8) << "threads" << std::setw(10) << "threshold"
+	          << std::setw(16) << "ns / retire" << std::setw(12) << "scans" << std::endl;
+	for (size_t threads = 1; threads <= 64; threads *= 2) {
+		scanCost<16>(threads, operations);
+		scanCost<64>(threads, operations);
+		scanCost<256>(threads, operations);
+	}
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace lockfree {
+
+/*
+* Event count - lets threads sleep until a condition, which is checked
+* without locks, may have changed:
+*   auto key = event.prepare();
+*   if ( condition()) { event.cancel(); ... } else event.wait( key );
+* and the thread changing the condition calls notify afterwards.
+*
+* Notify costs one load while nobody waits. It has to be preceded by
+* a seq_cst operation publishing the change (or a seq_cst fence), so
+* either the notifier sees the waiter registered, or the waiter sees
+* the change when it checks the condition again after prepare.
+*
+* Waiting threads sleep on a futex (C++20 atomic::wait is not available
+* in C++17), a notify changes the epoch, so no wakeup is lost between
+* prepare and wait.
+*/
+class EventCount {
+public:
+    using Key = uint32_t;
+
+    EventCount() = default;
+    EventCount( const EventCount& ) = delete;
+    EventCount& operator=( const EventCount& ) = delete;
+
+    // registers the thread as a waiter, the condition is to be checked again
+    Key prepare() {
+        _waiters.fetch_add( 1, std::memory_order_seq_cst );
+        return _epoch.load( std::memory_order_seq_cst );
+    }
+
+    // the condition is met after prepare, the thread does not wait
+    void cancel() {
+        _waiters.fetch_sub( 1, std::memory_order_relaxed );
+    }
+
+    // sleeps until a notify after prepare, which returned key
+    void wait( Key key ) {
+        while ( _epoch.load( std::memory_order_acquire ) == key )
+            futex( FUTEX_WAIT_PRIVATE, key, nullptr );
+        _waiters.fetch_sub( 1, std::memory_order_relaxed );
+    }
+
+    /*
+    * as wait, but returns after timeout at the latest;
+    * true if notified
+    */
+    bool wait_for( Key key, std::chrono::nanoseconds timeout ) {
+        timespec time;
+        time.tv_sec = static_cast< time_t >( timeout.count() / 1000000000 );
+        time.tv_nsec = static_cast< long >( timeout.count() % 1000000000 );
+        if ( _epoch.load( std::memory_order_acquire ) == key )
+            futex( FUTEX_WAIT_PRIVATE, key, &time );
+        _waiters.fetch_sub( 1, std::memory_order_relaxed );
+        return _epoch.load( std::memory_order_acquire ) != key;
+    }
+
+    // wakes one waiting thread, if there is any
+    void notify_one() {
+        notify( 1 );
+    }
+
+    void notify_all() {
+        notify( INT_MAX );
+    }
+
+    // the number of threads between prepare and the end of wait
+    size_t waiting() const {
+        return _waiters.load( std::memory_order_relaxed );
+    }
+
+private:
+    std::atomic< Key > _epoch{ 0 };
+    std::atomic< uint32_t > _waiters{ 0 };
+
+    void notify( int count ) {
+        if ( !_waiters.load( std::memory_order_seq_cst ))
+            return;
+        _epoch.fetch_add( 1, std::memory_order_seq_cst );
+        futex( FUTEX_WAKE_PRIVATE, Key( count ), nullptr );
+    }
+
+    long futex( int operation, Key value, const timespec *timeout ) {
+        static_assert( sizeof( std::atomic< Key > ) == sizeof( Key ), "futex needs a plain 32 bit word" );
+        return syscall( SYS_futex, reinterpret_cast< Key * >( &_epoch ), operation, value, timeout, nullptr, 0 );
+    }
+};
+
+} //namespace lockfree
@@ -0,0 +1,392 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cassert>
+#include <cstddef>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include "policy.h"
+#include "scan.h"
+
+namespace lockfree {
+namespace memPool {
+
+/*
+* Hierarchical atomic bitmap
+* Level 0 holds one bit per slot, set bit means the slot is taken.
+* Every upper level holds one bit per word of the level below,
+* which is set when that word is full. The top level is a single word,
+* so looking for a free slot costs one ctz per level and one fetch_or
+* on level 0, regardless of the number of slots.
+*
+* The upper levels are only hints. A word can be marked as not full
+* while it already is (the search repairs it on the way), but it is
+* never left marked as full once it contains a free bit - otherwise
+* the slots would be lost.
+*
+* Layout places the words of level 0 in memory (see policy::PackedFlags,
+* PaddedFlags and InterleavedFlags), the summary is always packed.
+*
+* If the word of the hint is full and the words are contiguous, its
+* neighbours up to the end of their two cache lines are probed for
+* a free bit by a vector scan (see scan.h) before the summary is walked,
+* so a nearly full pool is searched near the hint without touching
+* the shared upper levels.
+*/
+template< typename Layout = policy::PackedFlags >
+class BasicBitmap {
+public:
+    // the number of bits in one size_t (expects to be 64)
+    static constexpr size_t bits = sizeof( size_t ) * 8;
+    static constexpr size_t full = ~size_t( 0 );
+    static constexpr size_t npos = ~size_t( 0 );
+
+    /*
+    * Bits from available up to size start as taken,
+    * they can be made available later by release( from, to ).
+    */
+    explicit BasicBitmap( size_t size, size_t available = npos ) : _size( size ), _depth( 0 ) {
+        assert( size > 0 );
+        size_t total = 0;
+        size_t count = size;
+        do {
+            assert( _depth < maxLevels );
+            _count[ _depth ] = ( count + bits - 1 ) / bits;
+            _offset[ _depth ] = total;
+            total += _depth ? _count[ _depth ] : Layout::words( _count[ 0 ] );
+            count = _count[ _depth ];
+            ++_depth;
+        } while ( count > 1 );
+        _place = Layout::parameter( _count[ 0 ] );
+
+        //zeroed memory is obtained lazily from the system, so only
+        //words which are not zero are written; one line more for alignment
+        const size_t line = 64 / sizeof( size_t );
+        _memory.reset( std::calloc( total + line, sizeof( size_t )));
+        if ( !_memory )
+            throw std::bad_alloc();
+        uintptr_t begin = reinterpret_cast< uintptr_t >( _memory.get());
+        _words = reinterpret_cast< std::atomic< size_t > * >(( begin + 63 ) / 64 * 64 );
+        available = available < size ? available : size;
+        size_t first = available / bits;
+        for ( size_t i = first; i < _count[ 0 ]; ++i ) {
+            size_t begin = i * bits;
+            word( 0, i ) = begin >= available ? full : full << ( available - begin );
+        }
+        //bits beyond the end look as taken, so they are never returned
+        size_t tail = _size % bits;
+        if ( tail )
+            word( 0, _count[ 0 ] - 1 ) |= full << tail;
+        //the summary is built from the level below, words before first have free bits
+        for ( size_t level = 1; level < _depth; ++level ) {
+            first /= bits;
+            for ( size_t i = first; i < _count[ level ]; ++i ) {
+                size_t value = 0;
+                for ( size_t bit = 0; bit < bits; ++bit ) {
+                    size_t child = i * bits + bit;
+                    if ( child >= _count[ level - 1 ] || word( level - 1, child ).load() == full )
+                        value |= size_t( 1 ) << bit;
+                }
+                word( level, i ) = value;
+            }
+        }
+    }
+
+    BasicBitmap( const BasicBitmap& ) = delete;
+    BasicBitmap& operator=( const BasicBitmap& ) = delete;
+
+    /*
+    * Takes a free bit and returns its index, or npos if all bits are taken.
+    * The search prefers bits at or after the hint.
+    */
+    size_t acquire( size_t hint ) {
+        size_t index;
+        return acquire( hint, 1, &index ) ? index : npos;
+    }
+
+    /*
+    * Takes up to count (at most 64) free bits from one word by a single
+    * fetch_or and writes their indices to out. Returns the number of taken
+    * bits, which is smaller than count if the word has not enough free bits,
+    * and 0 if all bits are taken.
+    */
+    size_t acquire( size_t hint, size_t count, size_t *out ) {
+        policy::detail::NoProbe probe;
+        return acquire( hint, count, out, probe );
+    }
+
+    /*
+    * as above, reports every word tried and every lost fetch_or
+    * to probe (see policy::Statistics)
+    */
+    template< typename Probe >
+    size_t acquire( size_t hint, size_t count, size_t *out, Probe& probe ) {
+        assert( count > 0 );
+        count = std::min( count, bits );
+        hint %= _size;
+        //the word with the hint is tried first, the summary is used only when it is full
+        size_t index = hint / bits;
+        bool near = Layout::contiguous;
+        while ( true ) {
+            if ( word( 0, index ).load() != full ) {
+                size_t found = take( index, hint, count, out, probe );
+                if ( found )
+                    return found;
+            } else if ( near ) {
+                size_t neighbour = scanWindow( index );
+                if ( neighbour != npos ) {
+                    size_t found = take( neighbour, hint, count, out, probe );
+                    if ( found )
+                        return found;
+                }
+            }
+            near = false;
+
+            index = 0;
+            size_t level = _depth - 1;
+            for ( ; level > 0; --level ) {
+                size_t freeBits = ~word( level, index ).load();
+                if ( !freeBits )
+                    break;
+                index = index * bits + pick( freeBits, level, index, hint );
+            }
+
+            if ( level > 0 ) {
+                if ( level == _depth - 1 )
+                    return 0;
+                //the summary was stale, repair it and start again
+                markFull( level, index );
+                continue;
+            }
+
+            size_t found = take( index, hint, count, out, probe );
+            if ( found )
+                return found;
+            if ( _depth == 1 )
+                return 0;
+        }
+    }
+
+    /*
+    * Returns previously acquired bit.
+    */
+    void release( size_t index ) {
+        assert( index < _size );
+        size_t mask = size_t( 1 ) << ( index % bits );
+        size_t previous = word( 0, index / bits ).fetch_and( ~mask );
+        assert( previous & mask );
+        if ( previous == full )
+            markFree( 0, index / bits );
+    }
+
+    /*
+    * Returns all bits in range [from, to), which have to be taken.
+    */
+    void release( size_t from, size_t to ) {
+        assert( from <= to && to <= _size );
+        while ( from < to ) {
+            size_t offset = from % bits;
+            size_t count = std::min( bits - offset, to - from );
+            size_t mask = count == bits ? full : (( size_t( 1 ) << count ) - 1 ) << offset;
+            size_t previous = word( 0, from / bits ).fetch_and( ~mask );
+            assert(( previous & mask ) == mask );
+            if ( previous == full )
+                markFree( 0, from / bits );
+            from += count;
+        }
+    }
+
+    /*
+    * Returns count previously acquired bits, the bits of one word
+    * are cleared by a single fetch_and (indices of a word should be
+    * next to each other, as acquire returns them).
+    */
+    void release( const size_t *indices, size_t count ) {
+        size_t i = 0;
+        while ( i < count ) {
+            size_t index = indices[ i ] / bits;
+            size_t mask = 0;
+            for ( ; i < count && indices[ i ] / bits == index; ++i ) {
+                assert( indices[ i ] < _size );
+                mask |= size_t( 1 ) << ( indices[ i ] % bits );
+            }
+            size_t previous = word( 0, index ).fetch_and( ~mask );
+            assert(( previous & mask ) == mask );
+            if ( previous == full )
+                markFree( 0, index );
+        }
+    }
+
+    /*
+    * true if all bits were taken at some recent moment
+    * (the top word of the summary is full), costs one load
+    */
+    bool exhausted() const {
+        return word( _depth - 1, 0 ).load( std::memory_order_acquire ) == full;
+    }
+
+    bool test( size_t index ) const {
+        return ( word( 0, index / bits ).load() >> ( index % bits )) & 1;
+    }
+
+    size_t size() const {
+        return _size;
+    }
+
+    // number of words on level 0
+    size_t words() const {
+        return _count[ 0 ];
+    }
+
+    // value of a word on level 0
+    size_t word( size_t i ) const {
+        return word( 0, i ).load();
+    }
+
+private:
+    // 64^11 > 2^64, so no bitmap can have more levels
+    static constexpr size_t maxLevels = 11;
+    // words probed around a full hint word, two cache lines
+    static constexpr size_t window = 16;
+
+    struct Free {
+        void operator()( void *memory ) const {
+            std::free( memory );
+        }
+    };
+
+    std::unique_ptr< void, Free > _memory;
+    // aligned to a cache line
+    std::atomic< size_t > *_words;
+    size_t _size;
+    size_t _depth;
+    // argument of Layout::place
+    size_t _place;
+    size_t _count[maxLevels];
+    size_t _offset[maxLevels];
+
+    std::atomic< size_t >& word( size_t level, size_t index ) {
+        return _words[ level ? _offset[ level ] + index : Layout::place( index, _place ) ];
+    }
+
+    const std::atomic< size_t >& word( size_t level, size_t index ) const {
+        return _words[ level ? _offset[ level ] + index : Layout::place( index, _place ) ];
+    }
+
+    /*
+    * returns a word after index in its window, which is not full,
+    * or npos; expects contiguous layout
+    */
+    size_t scanWindow( size_t index ) const {
+        size_t end = std::min(( index / window + 1 ) * window, _count[ 0 ] );
+        size_t found = scan::find( _words, index + 1, end );
+        return found < end ? found : npos;
+    }
+
+    static size_t lowest( size_t value ) {
+        return static_cast< size_t >( __builtin_ctzll( value ));
+    }
+
+    /*
+    * selects one of freeBits in word on given level. If the word covers
+    * the hint, the first free bit at or after the hint is chosen
+    * (wrapping around), otherwise the lowest one.
+    */
+    static size_t pick( size_t freeBits, size_t level, size_t index, size_t hint ) {
+        size_t shift = 6 * level;
+        if (( hint >> shift ) / bits != index )
+            return lowest( freeBits );
+        size_t start = ( hint >> shift ) % bits;
+        size_t rotated = start ? ( freeBits >> start ) | ( freeBits << ( bits - start )) : freeBits;
+        return ( lowest( rotated ) + start ) % bits;
+    }
+
+    static size_t rotate( size_t value, size_t shift ) {
+        return shift ? ( value >> shift ) | ( value << ( bits - shift )) : value;
+    }
+
+    /*
+    * selects count of freeBits in word of level 0, the first ones
+    * at or after the hint (wrapping around), if the word covers it
+    */
+    static size_t select( size_t freeBits, size_t index, size_t hint, size_t count ) {
+        size_t start = hint / bits == index ? hint % bits : 0;
+        size_t rotated = rotate( freeBits, start );
+        size_t selected = 0;
+        for ( ; count && rotated; --count ) {
+            selected |= rotated & ( ~rotated + 1 );
+            rotated &= rotated - 1;
+        }
+        return rotate( selected, ( bits - start ) % bits );
+    }
+
+    /*
+    * tries to set up to count free bits in given word on level 0 at once,
+    * returns the number of set bits, 0 (and marks the word full) if there is none
+    */
+    template< typename Probe >
+    size_t take( size_t index, size_t hint, size_t count, size_t *out, Probe& probe ) {
+        auto& leaf = word( 0, index );
+        probe.word();
+        size_t previous = leaf.load();
+        while ( previous != full ) {
+            size_t mask = select( ~previous, index, hint, count );
+            previous = leaf.fetch_or( mask );
+            if ( previous & mask )
+                probe.collision();
+            //bits taken by other thread meanwhile are not ours
+            size_t taken = mask & ~previous;
+            if ( taken ) {
+                if (( previous | mask ) == full )
+                    markFull( 0, index );
+                size_t found = 0;
+                for ( ; taken; taken &= taken - 1 )
+                    out[ found++ ] = index * bits + lowest( taken );
+                return found;
+            }
+        }
+        markFull( 0, index );
+        return 0;
+    }
+
+    /*
+    * word on given level was seen full, so mark it in the level above.
+    * If the word has been freed meanwhile, the mark is taken back.
+    */
+    void markFull( size_t level, size_t index ) {
+        while ( level + 1 < _depth ) {
+            size_t mask = size_t( 1 ) << ( index % bits );
+            size_t previous = word( level + 1, index / bits ).fetch_or( mask );
+            if ( word( level, index ).load() != full ) {
+                markFree( level, index );
+                return;
+            }
+            if (( previous & mask ) || ( previous | mask ) != full )
+                return;
+            ++level;
+            index /= bits;
+        }
+    }
+
+    /*
+    * word on given level has got a free bit, clear its mark in the level
+    * above and continue up as long as the cleared word was full
+    */
+    void markFree( size_t level, size_t index ) {
+        while ( level + 1 < _depth ) {
+            size_t mask = size_t( 1 ) << ( index % bits );
+            size_t previous = word( level + 1, index / bits ).fetch_and( ~mask );
+            if ( previous != full )
+                return;
+            ++level;
+            index /= bits;
+        }
+    }
+};
+
+using Bitmap = BasicBitmap<>;
+
+} //namespace memPool
+} //namespace lockfree
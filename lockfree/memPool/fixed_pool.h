@@ -0,0 +1,183 @@
+#pragma once
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <map>
+#include <new>
+#include <typeindex>
+#include <cstddef>
+
+#include "slot_pool.h"
+
+namespace lockfree {
+namespace memPool {
+
+namespace detail {
+
+// memory for one object of T, nothing is constructed in it
+template< typename T >
+struct alignas( T ) Storage {
+    unsigned char _bytes[ sizeof( T ) ];
+};
+
+/*
+* SlotPools of one FixedPool and all its rebound copies - one pool
+* per slot type, created on the first rebind to that type.
+*/
+class PoolFamily {
+public:
+    PoolFamily( size_t size, size_t limit ) : _size( size ), _limit( limit ) {
+    }
+
+    template< typename Slots >
+    Slots& get() {
+        std::lock_guard< std::mutex > lock( _mutex );
+        auto& pool = _pools[ std::type_index( typeid( Slots )) ];
+        if ( !pool )
+            pool = std::make_shared< Slots >( _size, _limit );
+        return *static_cast< Slots * >( pool.get());
+    }
+
+private:
+    size_t _size;
+    size_t _limit;
+    std::mutex _mutex;
+    std::map< std::type_index, std::shared_ptr< void >> _pools;
+};
+
+} //namespace detail
+
+/*
+* FixedPool - allocator of single objects from a SlotPool
+* Satisfies the Allocator requirements, so it can be given to node based
+* containers (std::list, std::map, std::allocate_shared, ...), e.g.
+*   FixedPool< int > pool( 4096 );
+*   std::list< int, FixedPool< int >> list( pool );
+* Allocation of one object takes a slot of the pool lock-free, requests
+* for more objects at once go to std::allocator. If the pool is full
+* (and cannot grow up to its limit anymore), allocate throws std::bad_alloc.
+*
+* Copies share the pool, they compare equal. A copy rebound to other type
+* U uses the pool of U slots of the same family, which is created with
+* the same size and limit on first such rebind (under a mutex, containers
+* rebind once in constructor). The pools are freed with the last copy,
+* objects left in them are not destroyed.
+*
+* Policies are those of SlotPool (Magazines, Backing, Hint, Sizing, Layout).
+*/
+template< typename T, typename... Policies >
+class FixedPool {
+public:
+    using Slots = SlotPool< detail::Storage< T >, Policies... >;
+    using value_type = T;
+
+    template< typename U >
+    struct rebind {
+        using other = FixedPool< U, Policies... >;
+    };
+
+    // pool of size slots, which can grow up to limit slots (see SlotPool)
+    explicit FixedPool( size_t size, size_t limit = 0 )
+            : _family( std::make_shared< detail::PoolFamily >( size, limit )),
+              _slots( &_family->template get< Slots >()) {
+    }
+
+    template< typename U >
+    FixedPool( const FixedPool< U, Policies... >& other )
+            : _family( other._family ),
+              _slots( &_family->template get< Slots >()) {
+    }
+
+    T *allocate( size_t n ) {
+        if ( n != 1 )
+            return std::allocator< T >{ }.allocate( n );
+        size_t index = _slots->allocate();
+        if ( index == Bitmap::npos )
+            throw std::bad_alloc();
+        return reinterpret_cast< T * >( _slots->address( index ));
+    }
+
+    void deallocate( T *p, size_t n ) {
+        if ( n != 1 )
+            return std::allocator< T >{ }.deallocate( p, n );
+        _slots->deallocate( _slots->indexOf( reinterpret_cast< detail::Storage< T > * >( p )));
+    }
+
+    // the pool of T slots
+    Slots& slots() const {
+        return *_slots;
+    }
+
+    template< typename U >
+    bool operator==( const FixedPool< U, Policies... >& other ) const {
+        return _family == other._family;
+    }
+
+    template< typename U >
+    bool operator!=( const FixedPool< U, Policies... >& other ) const {
+        return !( *this == other );
+    }
+
+private:
+    template< typename, typename... >
+    friend class FixedPool;
+
+    std::shared_ptr< detail::PoolFamily > _family;
+    Slots *_slots;
+};
+
+/*
+* std::pmr::memory_resource adapter of FixedPool< T >
+* Blocks which fit into a slot of T (by size and alignment) are taken
+* from the pool, bigger blocks, and all blocks once the pool is full,
+* come from the upstream resource.
+*/
+template< typename T, typename... Policies >
+class FixedResource : public std::pmr::memory_resource {
+public:
+    explicit FixedResource( FixedPool< T, Policies... > pool,
+                            std::pmr::memory_resource *upstream = std::pmr::get_default_resource())
+            : _pool( std::move( pool )), _upstream( upstream ) {
+    }
+
+    FixedPool< T, Policies... >& pool() {
+        return _pool;
+    }
+
+    std::pmr::memory_resource *upstream_resource() const {
+        return _upstream;
+    }
+
+private:
+    FixedPool< T, Policies... > _pool;
+    std::pmr::memory_resource *_upstream;
+
+    static bool fits( size_t bytes, size_t alignment ) {
+        return bytes <= sizeof( T ) && alignment <= alignof( T );
+    }
+
+    void *do_allocate( size_t bytes, size_t alignment ) override {
+        if ( fits( bytes, alignment )) {
+            auto& slots = _pool.slots();
+            size_t index = slots.allocate();
+            if ( index != Bitmap::npos )
+                return slots.address( index );
+        }
+        return _upstream->allocate( bytes, alignment );
+    }
+
+    void do_deallocate( void *p, size_t bytes, size_t alignment ) override {
+        auto& slots = _pool.slots();
+        if ( fits( bytes, alignment ) && slots.contains( p ))
+            slots.deallocate( slots.indexOf( static_cast< detail::Storage< T > * >( p )));
+        else
+            _upstream->deallocate( p, bytes, alignment );
+    }
+
+    bool do_is_equal( const std::pmr::memory_resource& other ) const noexcept override {
+        return this == &other;
+    }
+};
+
+} //namespace memPool
+} //namespace lockfree
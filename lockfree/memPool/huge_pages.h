@@ -0,0 +1,94 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <sys/mman.h>
+
+namespace lockfree {
+namespace memPool {
+
+enum class Pages { transparent, explicit_ };
+
+/*
+* Allocator mapping memory directly by mmap, aligned to and rounded up
+* to huge pages (2 MiB), so big pools are covered by few TLB entries.
+*
+* Pages::transparent asks the kernel for transparent huge pages by madvise,
+* Pages::explicit_ maps them from the hugetlbfs pool (MAP_HUGETLB) and
+* falls back to transparent ones when the pool is empty or not configured.
+* Without huge page support the memory is just mapped by normal pages.
+*
+* The mapped memory is zeroed and it is faulted in on the first touch.
+* Usable as the Allocator of PoolAllocator (see policy::HugePages).
+*/
+template< typename T, Pages Kind = Pages::transparent >
+struct HugePageAllocator {
+    using value_type = T;
+
+    static constexpr size_t pageSize = size_t( 2 ) << 20;
+
+    template< typename U >
+    struct rebind {
+        using other = HugePageAllocator< U, Kind >;
+    };
+
+    HugePageAllocator() = default;
+
+    template< typename U >
+    HugePageAllocator( const HugePageAllocator< U, Kind >& ) { }
+
+    T *allocate( size_t count ) {
+        size_t length = bytes( count );
+        void *memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if ( Kind == Pages::explicit_ )
+            memory = mmap( nullptr, length, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+#endif
+        if ( memory == MAP_FAILED )
+            memory = mapAligned( length );
+        return static_cast< T * >( memory );
+    }
+
+    void deallocate( T *data, size_t count ) {
+        munmap( data, bytes( count ));
+    }
+
+    bool operator==( const HugePageAllocator& ) const {
+        return true;
+    }
+
+    bool operator!=( const HugePageAllocator& ) const {
+        return false;
+    }
+
+private:
+    static size_t bytes( size_t count ) {
+        return ( count * sizeof( T ) + pageSize - 1 ) / pageSize * pageSize;
+    }
+
+    /*
+    * maps a page more and unmaps the ends, so the memory starts
+    * on huge page boundary, which transparent huge pages need
+    */
+    static void *mapAligned( size_t length ) {
+        void *memory = mmap( nullptr, length + pageSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( memory == MAP_FAILED )
+            throw std::bad_alloc();
+        uintptr_t begin = reinterpret_cast< uintptr_t >( memory );
+        uintptr_t aligned = ( begin + pageSize - 1 ) / pageSize * pageSize;
+        if ( aligned > begin )
+            munmap( memory, aligned - begin );
+        if ( aligned + length < begin + length + pageSize )
+            munmap( reinterpret_cast< void * >( aligned + length ), begin + pageSize - aligned );
+#ifdef MADV_HUGEPAGE
+        //only a hint, the memory is usable without huge pages as well
+        madvise( reinterpret_cast< void * >( aligned ), length, MADV_HUGEPAGE );
+#endif
+        return reinterpret_cast< void * >( aligned );
+    }
+};
+
+} //namespace memPool
+} //namespace lockfree
@@ -0,0 +1,88 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+namespace lockfree {
+namespace memPool {
+namespace numa {
+
+/*
+* NUMA topology and memory placement by plain system calls, so nothing
+* has to be linked (libnuma calls the same mbind and get_mempolicy).
+* On a machine with one node, or a kernel without NUMA support,
+* there is one node 0 and binding does nothing.
+*/
+
+static constexpr size_t unknown = ~size_t( 0 );
+// nodes covered by the node mask given to mbind
+static constexpr size_t maxNodes = 64;
+
+// the number of nodes in the system (the highest online node + 1)
+inline size_t nodes() {
+    static const size_t count = [] {
+        size_t highest = 0;
+        if ( FILE *online = std::fopen( "/sys/devices/system/node/online", "r" )) {
+            //list of ranges, e.g. "0-1,3"
+            unsigned long first, last;
+            char separator;
+            while ( std::fscanf( online, "%lu", &first ) == 1 ) {
+                last = first;
+                if ( std::fscanf( online, "%c", &separator ) == 1 && separator == '-' ) {
+                    if ( std::fscanf( online, "%lu", &last ) != 1 )
+                        break;
+                    if ( std::fscanf( online, "%c", &separator ) != 1 )
+                        separator = '\n';
+                }
+                highest = std::max< size_t >( highest, last );
+                if ( separator != ',' )
+                    break;
+            }
+            std::fclose( online );
+        }
+        return std::min( highest + 1, maxNodes );
+    }();
+    return count;
+}
+
+// node of the CPU the calling thread runs on now (by getcpu, in vDSO)
+inline size_t node() {
+    unsigned cpu = 0, current = 0;
+    if ( getcpu( &cpu, &current ) != 0 )
+        return 0;
+    return current;
+}
+
+/*
+* asks the kernel to place the whole pages of given memory on node,
+* pages already touched are moved; falls back to other nodes
+* if the node has no free memory (MPOL_PREFERRED)
+*/
+inline bool bind( void *memory, size_t bytes, size_t node ) {
+    if ( node >= maxNodes )
+        return false;
+    const uintptr_t page = static_cast< uintptr_t >( sysconf( _SC_PAGESIZE ));
+    uintptr_t begin = ( reinterpret_cast< uintptr_t >( memory ) + page - 1 ) / page * page;
+    uintptr_t end = ( reinterpret_cast< uintptr_t >( memory ) + bytes ) / page * page;
+    if ( begin >= end )
+        return true;
+    unsigned long mask = 1UL << node;
+    return syscall( SYS_mbind, begin, end - begin, MPOL_PREFERRED, &mask, maxNodes + 1, MPOL_MF_MOVE ) == 0;
+}
+
+// node holding the page of given address, unknown if it is not faulted in
+inline size_t nodeOf( const void *address ) {
+    int node = -1;
+    if ( syscall( SYS_get_mempolicy, &node, nullptr, 0, address, MPOL_F_NODE | MPOL_F_ADDR ) != 0 || node < 0 )
+        return unknown;
+    return static_cast< size_t >( node );
+}
+
+} //namespace numa
+} //namespace memPool
+} //namespace lockfree
@@ -0,0 +1,672 @@
+#pragma once
+#include <type_traits>
+#include <cstddef>
+#include <memory>
+#include <atomic>
+#include <array>
+#include <random>
+#include <algorithm>
+
+#include "huge_pages.h"
+#include "numa.h"
+#include "../thread_index.h"
+#include "../sharded_counter.h"
+
+namespace lockfree {
+namespace memPool {
+namespace policy {
+
+/*
+* Options of memPool::Queue are given as a list of policies after
+* the size of the pool, in any order, e.g.
+*   Queue< int, 4096, policy::Magazines< 32 >>
+* Every policy derives from the tag of its kind, and select finds
+* the first policy of the given kind, or uses the default one.
+*/
+template< typename Kind, typename Default, typename... Policies >
+struct select {
+    using type = Default;
+};
+
+template< typename Kind, typename Default, typename Policy, typename... Policies >
+struct select< Kind, Default, Policy, Policies... > {
+    using type = std::conditional_t< std::is_base_of< Kind, Policy >::value,
+                                     Policy,
+                                     typename select< Kind, Default, Policies... >::type >;
+};
+
+template< typename Kind, typename Default, typename... Policies >
+using select_t = typename select< Kind, Default, Policies... >::type;
+
+struct magazines {};
+
+/*
+* Every thread keeps a small stack (magazine) of slots claimed in advance,
+* so most of allocations and deallocations do not touch the shared bitmap.
+* Magazines are refilled and flushed by halves of their capacity.
+* Only the first Threads threads (by lockfree::threadIndex) get a magazine,
+* others use the bitmap directly. Capacity 0 disables magazines.
+*/
+template< size_t Capacity, size_t Threads = 64 >
+struct Magazines : magazines {
+    static constexpr size_t capacity = Capacity;
+    static constexpr size_t threads = Capacity ? Threads : 0;
+};
+
+using NoMagazines = Magazines< 0 >;
+
+struct growth {};
+
+/*
+* The pool is allowed to grow up to Limit slots. New memory is appended
+* in slabs when the pool is exhausted, so push fails only on the Limit.
+*/
+template< size_t Limit >
+struct Growth : growth {
+    static constexpr size_t limit = Limit;
+};
+
+// the pool keeps the size given to the queue
+struct NoGrowth : growth {
+    static constexpr size_t limit = 0;
+};
+
+struct reference {};
+
+/*
+* Nodes are referenced by pointers with a small flag in the two low bits
+* (the flag wraps after three reuses of the slot).
+*/
+struct TaggedPointers : reference {};
+
+/*
+* Nodes are referenced by 32 bit slot index and 32 bit generation
+* packed into one 64 bit word, so ABA would need 2^32 reuses of a slot
+* while a thread is preempted.
+*/
+struct Handles : reference {};
+
+/*
+* Backing policies provide the memory of slabs. A stable backing keeps
+* every slab until the pool is destroyed, so memory of a freed node stays
+* a node - queues read nodes of other threads relying on it (see pop_bulk).
+*/
+struct backing {};
+
+// slabs of the pool are allocated by std::allocator
+struct Heap : backing {
+    static constexpr bool stable = true;
+
+    template< typename T >
+    using allocator = std::allocator< T >;
+};
+
+/*
+* slabs of the pool are mapped in huge pages (see HugePageAllocator),
+* every slab is rounded up to 2 MiB, so it pays off for big pools only
+*/
+template< Pages Kind = Pages::transparent >
+struct HugePages : backing {
+    static constexpr bool stable = true;
+
+    template< typename T >
+    using allocator = HugePageAllocator< T, Kind >;
+};
+
+struct hint {};
+
+/*
+* Hint policies choose the bit of the pool bitmap, where the search
+* for a free slot starts. Every policy has a State held by the pool:
+*   size_t next( size_t count, size_t capacity ) - start for count slots
+*   void freed( size_t index ) - called with every slot returned to the pool
+* and optionally (with static constexpr bool places = true)
+*   void placed( Slot *memory, size_t begin, size_t count ) - called with
+*     every slab of count slots from index begin, before it is used
+*/
+
+// one shared counter advanced by every allocation (threads walk the pool together)
+struct SequentialHint : hint {
+    class State {
+    public:
+        size_t next( size_t count, size_t capacity ) {
+            return _start.fetch_add( count, std::memory_order_relaxed ) % capacity;
+        }
+
+        void freed( size_t ) {
+        }
+
+    private:
+        std::atomic< size_t > _start{ 0 };
+    };
+};
+
+// uniformly random start, every thread has its own generator
+struct RandomHint : hint {
+    class State {
+    public:
+        size_t next( size_t, size_t capacity ) {
+            static thread_local std::minstd_rand generator( static_cast< unsigned >( threadIndex() + 1 ));
+            return generator() % capacity;
+        }
+
+        void freed( size_t ) {
+        }
+    };
+};
+
+namespace detail {
+
+// per thread value of the first Threads threads (by threadIndex), each on its own cache line
+template< size_t Threads >
+class PerThread {
+public:
+    // nullptr for threads above the limit
+    size_t *local() {
+        size_t thread = threadIndex();
+        return thread < Threads ? &_cells[ thread ].value : nullptr;
+    }
+
+private:
+    struct alignas( 64 ) Cell {
+        size_t value = 0;
+    };
+
+    std::array< Cell, Threads > _cells;
+};
+
+} //namespace detail
+
+/*
+* Thread affine regions: the pool is split into Regions regions of whole
+* bitmap words (and thus of whole runs of 64 nodes) and every thread
+* has a home region by its lockfree::threadIndex. The search always
+* starts at the beginning of the home region, so the thread takes
+* the lowest free slot there - mostly the one it has freed recently,
+* which is still in its cache - and other threads do not write into
+* its bitmap words. Only when the home region is full, the search
+* spills to the following regions. Threads above Regions share them.
+*/
+template< size_t Regions = 64 >
+struct AffineHint : hint {
+    static_assert( Regions > 0, "AffineHint needs at least one region" );
+
+    class State {
+    public:
+        size_t next( size_t, size_t capacity ) {
+            return home( threadIndex(), capacity );
+        }
+
+        void freed( size_t ) {
+        }
+
+        // the first slot of the home region of given thread
+        static size_t home( size_t thread, size_t capacity ) {
+            size_t region = capacity / Regions / word * word;
+            if ( !region )
+                region = word;
+            return ( thread % Regions ) * region % capacity;
+        }
+
+    private:
+        static constexpr size_t word = sizeof( size_t ) * 8;
+    };
+};
+
+/*
+* a thread starts at the slot it has freed last (which is probably
+* still in its cache), or sequentially if it has not freed any yet
+*/
+struct LastFreedHint : hint {
+    class State {
+    public:
+        size_t next( size_t count, size_t capacity ) {
+            size_t *last = _last.local();
+            if ( !last || !*last )
+                return _shared.next( count, capacity );
+            return ( *last - 1 ) % capacity;
+        }
+
+        void freed( size_t index ) {
+            if ( size_t *last = _last.local())
+                *last = index + 1;
+        }
+
+    private:
+        // index + 1 of the last freed slot, 0 if none
+        detail::PerThread< 64 > _last;
+        SequentialHint::State _shared;
+    };
+};
+
+enum class Placement { firstTouch, bind };
+
+/*
+* NUMA aware hint: every slab is split into one part of whole bitmap words
+* per NUMA node, and a thread starts the search in the part of the node
+* it runs on, walking it sequentially. The node is asked by getcpu once
+* per 1024 searches of the thread, so a migrated thread keeps its former
+* node for a while (which costs only locality). With Placement::bind,
+* the parts are placed on their nodes by mbind when the slab is created,
+* with Placement::firstTouch the pages land on the node of the thread,
+* which touches them first - the threads of the node by the hint
+* (unless the pool is prefaulted). On a single node it is SequentialHint.
+* With Growth the search starts in the part of the first slab.
+*/
+template< Placement Kind = Placement::bind >
+struct NumaHint : hint {
+    class State {
+    public:
+        static constexpr bool places = true;
+
+        State() : _nodes( numa::nodes()), _base( 0 ) {
+        }
+
+        size_t next( size_t count, size_t capacity ) {
+            size_t base = _base.load( std::memory_order_relaxed );
+            if ( _nodes == 1 || !base )
+                return _shared.next( count, capacity );
+            size_t node = currentNode() % _nodes;
+            size_t begin = part( node, base );
+            size_t size = part( node + 1, base ) - begin;
+            if ( !size )
+                return _shared.next( count, capacity );
+            return begin + _cursors[ node ].value.fetch_add( count, std::memory_order_relaxed ) % size;
+        }
+
+        void freed( size_t ) {
+        }
+
+        template< typename Slot >
+        void placed( Slot *memory, size_t begin, size_t count ) {
+            if ( !begin )
+                _base.store( count, std::memory_order_relaxed );
+            if ( _nodes == 1 || Kind != Placement::bind )
+                return;
+            for ( size_t node = 0; node < _nodes; ++node ) {
+                size_t from = part( node, count );
+                numa::bind( memory + from, ( part( node + 1, count ) - from ) * sizeof( Slot ), node );
+            }
+        }
+
+        // node, whose part of a slab of count slots holds given offset
+        size_t nodeOf( size_t offset, size_t count ) const {
+            size_t node = 0;
+            while ( node + 1 < _nodes && part( node + 1, count ) <= offset )
+                ++node;
+            return node;
+        }
+
+    private:
+        static constexpr size_t word = sizeof( size_t ) * 8;
+
+        struct alignas( 64 ) Cursor {
+            std::atomic< size_t > value{ 0 };
+        };
+
+        // searches of a thread between two getcpu calls
+        static constexpr size_t refresh = 1024;
+
+        size_t _nodes;
+        // size of the first slab, set by placed() while the pool is constructed
+        std::atomic< size_t > _base;
+        std::array< Cursor, numa::maxNodes > _cursors;
+        SequentialHint::State _shared;
+
+        // node of the calling thread, cached per thread
+        static size_t currentNode() {
+            struct Cached {
+                size_t node = 0;
+                size_t left = 0;
+            };
+            thread_local Cached cached;
+            if ( !cached.left ) {
+                cached.node = numa::node();
+                cached.left = refresh;
+            }
+            --cached.left;
+            return cached.node;
+        }
+
+        // the first slot of part of node in a slab of count slots
+        size_t part( size_t node, size_t count ) const {
+            return count / word * node / _nodes * word;
+        }
+    };
+};
+
+namespace detail {
+
+// whether hint State wants to know about new slabs
+template< typename State, typename = void >
+struct places : std::false_type {};
+
+template< typename State >
+struct places< State, std::void_t< decltype( State::places ) >> : std::integral_constant< bool, State::places > {};
+
+} //namespace detail
+
+struct sizing {};
+
+/*
+* With Enabled, the pool counts its used slots (and queues their nodes),
+* so it can refuse allocation without searching when it is full,
+* and used() and available() can be called. This costs an atomic
+* operation on a shared counter per allocation and release.
+*/
+template< bool Enabled >
+struct HoldSize : sizing {
+    static constexpr bool enabled = Enabled;
+    static constexpr bool sharded = false;
+    using Counter = std::atomic< size_t >;
+};
+
+/*
+* The pool (and queues) count used slots in a ShardedCounter, so the
+* counting does not bounce one cache line between cores. used() is exact
+* with Batch 0 (and sums all shards), with Batch > 0 it is approximate
+* (off by less than Shards * Batch) and reads one word.
+* A full pool is recognized by the top word of the bitmap summary
+* instead of the counter, and the pool keeps no slots in reserve.
+*/
+template< size_t Shards = 64, size_t Batch = 0 >
+struct ShardedSize : sizing {
+    static constexpr bool enabled = true;
+    static constexpr bool sharded = true;
+    using Counter = ShardedCounter< Shards, Batch >;
+};
+
+using SizeTracking = HoldSize< true >;
+using NoSizeTracking = HoldSize< false >;
+
+struct layout {};
+
+/*
+* Layout policies place words of level 0 of the pool bitmap in memory:
+*   static size_t words( size_t count ) - memory (in words) for count words
+*   static size_t parameter( size_t count ) - computed once per bitmap
+*   static size_t place( size_t index, size_t parameter ) - position of a word
+*   static constexpr bool contiguous - word i is at position i
+* The bitmap memory is aligned to a cache line of 64 bytes.
+*/
+
+// words next to each other, eight words share a cache line
+struct PackedFlags : layout {
+    static constexpr bool contiguous = true;
+
+    static size_t words( size_t count ) {
+        return count;
+    }
+
+    static size_t parameter( size_t ) {
+        return 0;
+    }
+
+    static size_t place( size_t index, size_t ) {
+        return index;
+    }
+};
+
+/*
+* every Group words have a cache line of their own, so threads working
+* in different groups never invalidate each other, at the cost
+* of 8 / Group times more memory
+*/
+template< size_t Group = 1 >
+struct PaddedFlags : layout {
+    static_assert( Group > 0 && Group <= 8, "PaddedFlags groups at most 8 words in a line" );
+
+    static constexpr bool contiguous = false;
+
+    static size_t words( size_t count ) {
+        return ( count + Group - 1 ) / Group * 8;
+    }
+
+    static size_t parameter( size_t ) {
+        return 0;
+    }
+
+    static size_t place( size_t index, size_t ) {
+        return index / Group * 8 + index % Group;
+    }
+};
+
+/*
+* consecutive words are spread over different cache lines (word i is
+* in line i % lines, where lines is a power of two), so threads walking
+* the pool sequentially side by side do not share lines, while the memory
+* is at most doubled. Words far apart share lines instead.
+*/
+struct InterleavedFlags : layout {
+    static constexpr bool contiguous = false;
+
+    static size_t words( size_t count ) {
+        return size_t( 1 ) << ( parameter( count ) + 3 );
+    }
+
+    // log2 of the number of lines
+    static size_t parameter( size_t count ) {
+        size_t shift = 0;
+        while (( size_t( 8 ) << shift ) < count )
+            ++shift;
+        return shift;
+    }
+
+    static size_t place( size_t index, size_t shift ) {
+        return ( index & (( size_t( 1 ) << shift ) - 1 )) * 8 + ( index >> shift );
+    }
+};
+
+struct statistics {};
+
+namespace detail {
+
+// probe of a bitmap search, which records nothing
+struct NoProbe {
+    void word() {
+    }
+
+    void collision() {
+    }
+};
+
+} //namespace detail
+
+// no statistics are kept, the hooks of the pool are empty
+struct NoStatistics : statistics {
+    static constexpr bool enabled = false;
+
+    struct State {
+        using Probe = detail::NoProbe;
+
+        Probe probe() {
+            return Probe();
+        }
+
+        void allocated( const Probe&, size_t ) {
+        }
+
+        void failed() {
+        }
+
+        void released( size_t ) {
+        }
+    };
+};
+
+/*
+* The pool counts its allocations, failed allocations, releases,
+* fetch_or which lost bits to other thread (collisions), the number
+* of bitmap words tried by an allocation (probe length) and the highest
+* number of used slots.
+*
+* The first Threads threads (by lockfree::threadIndex) count in cells
+* of their own by plain loads and stores, others share one cell by atomic
+* increments. The cells are summed, when the statistics are read.
+* The peak is sampled every 64 allocations of a thread and on every
+* read, so it may miss short peaks.
+*/
+template< size_t Threads = 64 >
+struct Statistics : statistics {
+    static constexpr bool enabled = true;
+    // probe lengths: 0 (from a magazine), 1, 2, 3-4, 5-8, 9-16, 17-32, 33-64, more
+    static constexpr size_t buckets = 9;
+
+    struct Snapshot {
+        size_t allocations = 0;
+        size_t failures = 0;
+        size_t releases = 0;
+        size_t collisions = 0;
+        size_t peak = 0;
+        // allocations by the number of bitmap words tried
+        std::array< size_t, buckets > probes{ };
+
+        size_t used() const {
+            return allocations > releases ? allocations - releases : 0;
+        }
+    };
+
+    // bucket of a probe length
+    static size_t bucket( size_t words ) {
+        if ( words <= 1 )
+            return words;
+        size_t log = 63 - static_cast< size_t >( __builtin_clzll( words - 1 ));
+        return std::min( buckets - 1, 2 + log );
+    }
+
+    class State {
+    public:
+        struct Probe {
+            size_t words = 0;
+            size_t collisions = 0;
+
+            void word() {
+                ++words;
+            }
+
+            void collision() {
+                ++collisions;
+            }
+        };
+
+        Probe probe() {
+            return Probe();
+        }
+
+        void allocated( const Probe& probe, size_t count ) {
+            size_t thread = local();
+            Cell& cell = _cells[ thread ];
+            size_t allocations = add( thread, cell.allocations, count );
+            add( thread, cell.collisions, probe.collisions );
+            add( thread, cell.probes[ bucket( probe.words ) ], 1 );
+            if ( allocations / sample != ( allocations - count ) / sample )
+                peak( sum().used());
+        }
+
+        void failed() {
+            size_t thread = local();
+            add( thread, _cells[ thread ].failures, 1 );
+        }
+
+        void released( size_t count ) {
+            size_t thread = local();
+            add( thread, _cells[ thread ].releases, count );
+        }
+
+        Snapshot snapshot() {
+            Snapshot total = sum();
+            peak( total.used());
+            total.peak = _peak.load( std::memory_order_relaxed );
+            return total;
+        }
+
+    private:
+        static constexpr size_t sample = 64;
+
+        struct alignas( 64 ) Cell {
+            std::atomic< size_t > allocations{ 0 };
+            std::atomic< size_t > failures{ 0 };
+            std::atomic< size_t > releases{ 0 };
+            std::atomic< size_t > collisions{ 0 };
+            std::array< std::atomic< size_t >, buckets > probes{ };
+        };
+
+        // the last cell is shared by threads above Threads
+        std::array< Cell, Threads + 1 > _cells;
+        alignas( 64 ) std::atomic< size_t > _peak{ 0 };
+
+        // cell of the calling thread
+        static size_t local() {
+            size_t thread = threadIndex();
+            return thread < Threads ? thread : Threads;
+        }
+
+        // adds value to counter of the cell, returns the new value
+        static size_t add( size_t cell, std::atomic< size_t >& counter, size_t value ) {
+            if ( cell == Threads )
+                return counter.fetch_add( value, std::memory_order_relaxed ) + value;
+            size_t next = counter.load( std::memory_order_relaxed ) + value;
+            counter.store( next, std::memory_order_relaxed );
+            return next;
+        }
+
+        Snapshot sum() const {
+            Snapshot total;
+            for ( auto& cell : _cells ) {
+                total.allocations += cell.allocations.load( std::memory_order_relaxed );
+                total.failures += cell.failures.load( std::memory_order_relaxed );
+                total.releases += cell.releases.load( std::memory_order_relaxed );
+                total.collisions += cell.collisions.load( std::memory_order_relaxed );
+                for ( size_t i = 0; i < buckets; ++i )
+                    total.probes[ i ] += cell.probes[ i ].load( std::memory_order_relaxed );
+            }
+            return total;
+        }
+
+        void peak( size_t used ) {
+            size_t current = _peak.load( std::memory_order_relaxed );
+            while ( current < used && !_peak.compare_exchange_weak( current, used, std::memory_order_relaxed )) { }
+        }
+    };
+};
+
+struct reclamation {};
+
+enum class Scheme { immediate, hazard, epoch };
+
+/*
+* Popped sentinel is returned to the pool right away. Other threads
+* may still read it, which is safe only as the pool memory is never
+* returned to the system while the queue exists. Values are read before
+* they are unlinked only if T is trivially copyable, other types need
+* hazard pointers to be read safely.
+*/
+struct Immediate : reclamation {
+    static constexpr Scheme scheme = Scheme::immediate;
+    static constexpr size_t threshold = 0;
+};
+
+/*
+* Popped sentinels are retired to a hazard pointer domain of the queue
+* and returned to the pool once no thread can access them. Every thread
+* scans its retired list after Threshold retired nodes.
+*/
+template< size_t Threshold = 64 >
+struct HazardPointers : reclamation {
+    static constexpr Scheme scheme = Scheme::hazard;
+    static constexpr size_t threshold = Threshold;
+};
+
+/*
+* Popped sentinels are retired to an epoch based domain (lockfree::epoch),
+* which can be shared by many queues - by default the global one.
+* Nodes are returned to the pool in batches, once no thread can reach them.
+*/
+struct Epochs : reclamation {
+    static constexpr Scheme scheme = Scheme::epoch;
+    static constexpr size_t threshold = 0;
+};
+
+} //namespace policy
+} //namespace memPool
+} //namespace lockfree
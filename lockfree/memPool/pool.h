@@ -0,0 +1,370 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <random>
+#include <array>
+#include <thread>
+#include <vector>
+#include <tuple>
+#include <cstdint>
+#include <type_traits>
+#include <new>
+#include <cassert>
+
+#include "slot_pool.h"
+#include "policy.h"
+
+namespace lockfree {
+namespace memPool {
+
+template< typename T >
+void destroy_at( T *p ) {
+    p->~T();
+}
+
+namespace detail {
+
+// tag of a node constructed without a value (the sentinel of a queue)
+struct Hollow {
+};
+
+/*
+*Internal structure for holding inserted object
+*The value lives in uninitialized storage, so the sentinel needs
+*no value and T need not be default constructible. The node does not
+*destroy its value, the queue does, once the value is moved out.
+*/
+template< typename T, bool Handles >
+struct Node {
+    /*
+    * reference to a node as held in head, tail and _next
+    * pointer mode: pointer with flag on low bits
+    * handle mode: generation on high 32 bits, index + 1 on low 32 bits
+    * (index 0 is null, the null link of a node holds its generation)
+    */
+    using link = std::conditional_t< Handles, uint64_t, Node * >;
+
+    // the value is constructed in place from args
+    template< typename... Args >
+    explicit Node( Args&& ... args ) : _next( link() ) {
+        new( _storage ) T( std::forward< Args >( args )... );
+    }
+
+    explicit Node( Hollow ) : _next( link() ) {
+    }
+
+    T& value() {
+        return *std::launder( reinterpret_cast< T * >( _storage ));
+    }
+
+    void destroyValue() {
+        memPool::destroy_at( &value());
+    }
+
+    alignas( T ) unsigned char _storage[ sizeof( T ) ];
+    // held node is just a link - can contains flag
+    std::atomic< link > _next;
+};
+
+template< typename T, typename... Policies >
+using NodeOf = Node< T, std::is_same< policy::select_t< policy::reference, policy::TaggedPointers, Policies... >,
+                                      policy::Handles >::value >;
+
+} //namespace detail
+
+/*
+* Pool - the manager of memory of memPool queues
+* The slots of a SlotPool hold the nodes of queues.
+* To prevent ABA problem, the pointer obtains a flag.
+*
+* The pool is sized at runtime and it is either owned by one queue,
+* or constructed by the user and shared by any number of queues
+* of the same node type (Queue::Pool), which then must not outlive it.
+*
+* Nothing is written to the slabs in advance: the last flag of every node
+* is set to 0 in chunks of up to 4096 slots, when the first slot
+* of the chunk is constructed (or by prefault). The states of the chunks
+* of a slab are allocated by the first construct in the slab.
+*
+* In handle mode, the allocator hands out links made of the slot index
+* and its generation, which is increased on every reuse of the slot.
+* The node address is then computed from the index and no address
+* arithmetic is needed at all.
+*/
+template< typename T, typename... Policies >
+class Pool : public SlotPool< detail::NodeOf< T, Policies... >, Policies... > {
+public:
+    using Slots = SlotPool< detail::NodeOf< T, Policies... >, Policies... >;
+    using Reference = policy::select_t< policy::reference, policy::TaggedPointers, Policies... >;
+
+    static constexpr bool handles = std::is_same< Reference, policy::Handles >::value;
+
+    using node = detail::NodeOf< T, Policies... >;
+    using link = typename node::link;
+    using value_type = node;
+    using pointer = node *;
+
+    /*
+    * Pool of size slots, which can grow up to limit slots.
+    * Both are rounded up to multiple of 64, limit is at least size.
+    */
+    explicit Pool( size_t size, size_t limit = 0 ) : Slots( size, limit ) {
+        assert( !handles || this->_limit < ( size_t( 1 ) << 32 ));
+
+        for ( auto& states : _ready ) {
+            states.store( nullptr, std::memory_order_relaxed );
+        }
+    }
+
+    Pool( const Pool& ) = delete;
+    Pool& operator=( const Pool& ) = delete;
+
+    ~Pool() {
+        for ( auto& states : _ready ) {
+            delete[] states.load( std::memory_order_relaxed );
+        }
+    }
+
+    bool operator==( const Pool& other ) const {
+        return this == &other;
+    }
+
+    bool operator!=( const Pool& other ) const {
+        return !( *this == other );
+    }
+
+    /*
+    * firstly, allocates (obtains) a new space in memory
+    * secondly, constructs object with given arguments.
+    * similar to emplace_back on vector.
+    * If the constructor throws, the slot is freed again.
+    * flag is set, before returning an pointer.
+    */
+    template< class... Args >
+    link construct( Args&& ... args ) {
+        size_t index = this->allocate();
+        if ( index == Bitmap::npos )
+            return link();
+
+        prepare( index );
+        pointer data = this->address( index );
+        uint32_t lastFlag = *reinterpret_cast<uint32_t *>(data);
+        try {
+            new( data ) node( std::forward< Args >( args )... );
+        } catch ( ... ) {
+            //the slot is returned as it was
+            *reinterpret_cast<uint32_t *>(data) = lastFlag;
+            this->deallocate( index );
+            throw;
+        }
+        return makeLink( data, index, lastFlag + 1 );
+    }
+
+    /*
+    * returns the node the link refers to
+    */
+    node *get( link l ) const {
+        if constexpr ( handles ) {
+            return this->address(( l & 0xFFFFFFFF ) - 1 );
+        } else {
+            return clearFlag( l ).first;
+        }
+    }
+
+    /*
+    * firstly, clear pointer from its flag
+    * secondly, call destructor on data,
+    * and stores last flag for nex allocation
+    * afterwards, the flag on allocated data is set to 0
+    * this indicates that the memory is again available
+    */
+    void destruct( link data ) {
+        this->deallocate( destroy( data ));
+    }
+
+    /*
+    * initializes (and thus faults in) the whole current pool
+    * using given number of threads, so first allocations do not pay for it
+    */
+    void prefault( size_t threads = 1 ) {
+        size_t capacity = this->capacity();
+        // the first slot of the next chunk to prepare
+        std::atomic< size_t > next( 0 );
+        auto work = [this, &next, capacity] {
+            for ( size_t index = next.load(); index < capacity; ) {
+                if ( next.compare_exchange_weak( index, chunkEnd( index ))) {
+                    prepare( index );
+                    index = next.load();
+                }
+            }
+        };
+        std::vector< std::thread > workers;
+        for ( size_t i = 1; i < threads; ++i ) {
+            workers.emplace_back( work );
+        }
+        work();
+        for ( auto& worker : workers ) {
+            worker.join();
+        }
+    }
+
+    /*
+    * as destruct for count links, the slots are returned to the bitmap
+    * at once (one atomic operation per word)
+    */
+    void destruct_n( const link *links, size_t count ) {
+        size_t indices[ Slots::max ];
+        while ( count ) {
+            size_t batch = std::min( count, Slots::max );
+            for ( size_t i = 0; i < batch; ++i )
+                indices[ i ] = destroy( links[ i ] );
+            this->deallocate_n( indices, batch );
+            links += batch;
+            count -= batch;
+        }
+    }
+
+    /*
+    * destroys the values of all nodes in use, but the one of except
+    * (the sentinel), when the pool is used by a single queue which
+    * is being destroyed - the used slots are found by ctz over
+    * the bitmap words, the bitmap is not updated anymore
+    */
+    void destroyValues( link except ) {
+        //parked slots are free, they must not be destroyed
+        this->flush();
+        node *sentinel = get( except );
+        this->occupied( [this, sentinel]( size_t index ) {
+            node *current = this->address( index );
+            if ( current != sentinel )
+                current->destroyValue();
+        } );
+    }
+
+private:
+    // slots initialized at once, chunks start at the beginning of their slab
+    static constexpr size_t chunk = 4096;
+    // states of the chunks of every slab, allocated by its first use
+    std::array< std::atomic< std::atomic< uint8_t > * >, Slots::maxSlabs > _ready;
+
+    /*
+    * clears the flag, calls destructor on data and stores the last flag
+    * for next allocation. Returns index of the freed slot.
+    */
+    size_t destroy( link l ) {
+        size_t index;
+        uint32_t flag;
+        pointer data;
+        if constexpr ( handles ) {
+            index = ( l & 0xFFFFFFFF ) - 1;
+            flag = static_cast< uint32_t >( l >> 32 );
+            data = this->address( index );
+        } else {
+            std::tie( data, flag ) = clearFlag( l );
+            index = this->indexOf( data );
+        }
+        destroyAt( data, flag );
+        return index;
+    }
+
+    static void destroyAt( pointer data, uint32_t flag ) {
+        memPool::destroy_at<node>( data );
+        uint32_t *storeLastFlag = reinterpret_cast<uint32_t *>(data);
+        *storeLastFlag = flag;
+    }
+
+    link makeLink( pointer data, size_t index, uint32_t flag ) {
+        if constexpr ( handles ) {
+            //null link in _next carries the generation too, so a stale
+            //CAS on _next of a reused node fails
+            link generation = link( flag ) << 32;
+            data->_next.store( generation, std::memory_order_relaxed );
+            return generation | ( index + 1 );
+        } else {
+            ( void ) index;
+            return addFlag( data, flag );
+        }
+    }
+
+    enum : uint8_t { empty, preparing, ready };
+
+    /*
+    * the data holds it's last flag for pointers: need to be set to 0
+    * before the first use of the chunk of index. One thread prepares
+    * the chunk, others wait for it.
+    */
+    void prepare( size_t index ) {
+        size_t slab = this->slabOf( index );
+        size_t begin = ( index - this->slabBase( slab )) / chunk * chunk;
+        auto& state = states( slab )[ begin / chunk ];
+        if ( state.load( std::memory_order_acquire ) == ready )
+            return;
+        uint8_t expected = empty;
+        if ( state.compare_exchange_strong( expected, preparing )) {
+            size_t count = std::min( chunk, this->slabSize( slab ) - begin );
+            pointer data = this->address( this->slabBase( slab ) + begin );
+            for (size_t i = 0; i < count; ++i) {
+                uint32_t *flagHolder = reinterpret_cast<uint32_t *>(data + i);
+                *flagHolder = 0;
+            }
+            state.store( ready, std::memory_order_release );
+        } else {
+            while ( state.load( std::memory_order_acquire ) != ready ) { }
+        }
+    }
+
+    /*
+    * the chunk states of slab, the first user allocates them
+    * (if more threads do, only one array is kept)
+    */
+    std::atomic< uint8_t > *states( size_t slab ) {
+        std::atomic< uint8_t > *current = _ready[ slab ].load( std::memory_order_acquire );
+        if ( current )
+            return current;
+        size_t count = ( this->slabSize( slab ) + chunk - 1 ) / chunk;
+        auto *fresh = new std::atomic< uint8_t >[count];
+        for ( size_t i = 0; i < count; ++i ) {
+            fresh[ i ].store( empty, std::memory_order_relaxed );
+        }
+        if ( _ready[ slab ].compare_exchange_strong( current, fresh ))
+            return fresh;
+        delete[] fresh;
+        return current;
+    }
+
+    // the first slot after the chunk of index
+    size_t chunkEnd( size_t index ) const {
+        size_t slab = this->slabOf( index );
+        size_t begin = this->slabBase( slab );
+        return begin + std::min(( index - begin ) / chunk * chunk + chunk, this->slabSize( slab ));
+    }
+
+    /*
+    * adds flag to pointer to node, defined by number % 3
+    * as the flag is set to the two low bits, which are available to this
+    * usage thaks to aligned memory, the flags can be only [0,3]
+    */
+    static node *addFlag( node *in, size_t number = 1 ) {
+        number %= 3;
+        uintptr_t pointer = reinterpret_cast<uintptr_t>(in);
+        pointer |= number;
+        return reinterpret_cast<node *>(pointer);
+    }
+
+    /*
+    * clears the flag from a pointer to node, and returns this flag.
+    * expects the flag only on 2 low bits.
+    */
+    static std::pair< node *, uint32_t > clearFlag( node *toClear ) {
+        uintptr_t pointer = reinterpret_cast<uintptr_t>(toClear);
+        uintptr_t clearFlag = 0xFFFFFFFFFFFFFFFC;
+
+        uint32_t flag = static_cast<uint32_t>(pointer & ( ~clearFlag ));
+
+        pointer &= clearFlag;
+        return { reinterpret_cast<node *>(pointer), flag };
+    }
+};
+
+} //namespace memPool
+} //namespace lockfree
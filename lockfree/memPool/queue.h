@@ -1,86 +1,201 @@
+#pragma once
 #include <atomic>
 #include <memory>
-#include <random>
 #include <iostream>
 #include <mutex>
+#include <chrono>
+#include <iterator>
+#include <cstdint>
+#include <type_traits>
+#include <new>
 #include <cassert>
 
+#include "pool.h"
+#include "policy.h"
+#include "../reclamation/hazard.h"
+#include "../reclamation/epoch.h"
+#include "../event_count.h"
+
 namespace lockfree {
 namespace memPool {
 
-template< typename T >
-void destroy_at( T *p ) {
-    p->~T();
-}
-
-#ifndef RANDOM
-#define RANDOM 0
-#endif
-
-#ifndef HOLDSIZE
-#define HOLDSIZE 0
-#endif
-
 /*
 * lock free queue
 * The stack holds an memory pool, that provides the memory
 * The memory provides more efficient allocation.
 * To prevent ABA problem, every pointer contains also flag (on low bits)
 * The queue contains always at least one element - sentinel.
-* It's value is unimportant.
+* It holds no value: nodes keep values in uninitialized storage,
+* a value is destroyed right after pop moves it out, and that node
+* becomes the new sentinel. So T need not be default constructible.
 * Generally holds, that variable with _f contains flag,
 * and thus can not be dereferenced.
+* Further options are given as policies (see policy.h).
 */
-template< typename T, size_t PoolAllocatorSize = 2048 >
+template< typename T, size_t PoolAllocatorSize = 2048, typename... Policies >
 struct Queue {
 
+    using Growth = policy::select_t< policy::growth, policy::NoGrowth, Policies... >;
     /*
-    *Internal structure for holding inserted object
+    * values, which are not trivially copyable, are moved out after the node
+    * is won, so the node must not be reused by then - hazard pointers are
+    * the default for them
     */
-    struct node {
-        node( T value ) : _value( value ), _next( nullptr ) {
-        }
+    using Reclamation = policy::select_t< policy::reclamation,
+                                          std::conditional_t< std::is_trivially_copyable< T >::value,
+                                                              policy::Immediate, policy::HazardPointers<>>,
+                                          Policies... >;
 
-        node() : _value( T() ), _next( nullptr ) {
-        }
+    /*
+    * pool of nodes, which can be given to queues of the same type
+    * (or with the same T, Magazines, Reference, Backing, Hint, Sizing, Layout and Statistics policies)
+    */
+    using Pool = memPool::Pool< T,
+                                policy::select_t< policy::magazines, policy::NoMagazines, Policies... >,
+                                policy::select_t< policy::reference, policy::TaggedPointers, Policies... >,
+                                policy::select_t< policy::backing, policy::Heap, Policies... >,
+                                policy::select_t< policy::hint, policy::SequentialHint, Policies... >,
+                                policy::select_t< policy::sizing, policy::NoSizeTracking, Policies... >,
+                                policy::select_t< policy::layout, policy::PackedFlags, Policies... >,
+                                policy::select_t< policy::statistics, policy::NoStatistics, Policies... >>;
+    using node = typename Pool::node;
+    using link = typename Pool::link;
+
+    static constexpr bool handles = Pool::handles;
+    static constexpr bool hazardPointers = Reclamation::scheme == policy::Scheme::hazard;
+    static constexpr bool epochs = Reclamation::scheme == policy::Scheme::epoch;
+    static constexpr bool immediate = Reclamation::scheme == policy::Scheme::immediate;
+
+    // tries of push_wait and pop_wait before they sleep
+    static constexpr size_t spin = 64;
+
+    // the maximal number of slots the pool can grow to
+    static constexpr size_t PoolAllocatorLimit = Growth::limit ? Growth::limit : PoolAllocatorSize;
+
+    static_assert(( PoolAllocatorSize % Pool::max ) == 0, "The size of PoolAllocator must be multiple of 64" );
+    static_assert(( PoolAllocatorLimit % Pool::max ) == 0, "The limit of PoolAllocator must be multiple of 64" );
+    static_assert( PoolAllocatorLimit >= PoolAllocatorSize, "The limit of PoolAllocator must not be smaller than its size" );
+    static_assert( !handles || PoolAllocatorLimit < ( size_t( 1 ) << 32 ), "Handles can address only 2^32 - 1 slots" );
+    static_assert( !immediate || std::is_trivially_copyable< T >::value,
+                   "policy::Immediate needs trivially copyable T, use policy::HazardPointers or policy::Epochs" );
+
+    Queue() : Queue( epoch::Domain::global()) {
+    }
 
-        T _value;
-        // held node is just a pointer - can contains flag
-        std::atomic< node * > _next;
-    };
+    /*
+    * with policy::Epochs the queue retires nodes to given domain,
+    * which may be shared with other queues; otherwise it is not used
+    */
+    explicit Queue( epoch::Domain& domain )
+            : Queue( new Pool( PoolAllocatorSize, PoolAllocatorLimit ), nullptr, domain ) {
+    }
 
-    Queue() : allocator(), head( allocator.construct()), tail( head.load()) {
+    /*
+    * the queue takes its nodes from given pool, which may be shared
+    * with other queues and has to outlive them. PoolAllocatorSize and
+    * Growth of the queue are not used then. Throws std::bad_alloc,
+    * if the pool has no slot left for the sentinel.
+    */
+    explicit Queue( Pool& pool, epoch::Domain& domain = epoch::Domain::global())
+            : Queue( nullptr, &pool, domain ) {
     }
 
     /*
     * Method push.
     * returns bool - if the item was successfully inserted.
     * Insert fails only if the memory pool was full.
+    * The value is moved into the node.
     */
     bool push( T value ) {
-        node *toInsert = allocator.construct( std::move( value ));
-        if ( !toInsert )
+        return emplace( std::move( value ));
+    }
+
+    /*
+    * Method emplace.
+    * constructs the item in the node from args, returns bool as push.
+    * If the pool is full, args are left untouched.
+    */
+    template< typename... Args >
+    bool emplace( Args&& ... args ) {
+        link toInsert = construct( std::forward< Args >( args )... );
+        //retired nodes may hold the rest of the pool, args are not used yet
+        if ( isNull( toInsert ) && !immediate && collect())
+            toInsert = construct( std::forward< Args >( args )... );
+        if ( isNull( toInsert ))
             return false;
 
-        while ( true ) {
-            auto last_f = tail.load();
-            auto last = clear( last_f );
-            auto next_f = last->_next.load();
+        append( toInsert, toInsert );
+        return true;
+    }
 
-            if ( last_f == tail ) {
-                if ( next_f == nullptr ) {
-                    //try to add me as last
-                    if ( last->_next.compare_exchange_weak( next_f, toInsert )) {
-                        //I was successful, so try to become the new tail
-                        tail.compare_exchange_weak( last_f, toInsert );
-                        //if i hasn't been successful it means, that some other node becomes tail
-                        return true;
-                    }
-                } else {
-                    //help other node to become a tail
-                    tail.compare_exchange_weak( last_f, next_f );
-                }
+    /*
+    * Method push_bulk.
+    * inserts the items of [first, last) in their order: the nodes are
+    * chained privately and the chain is linked to the queue at once
+    * (one CAS on _next and one on tail for the whole batch).
+    * returns the number of items inserted - if the pool gets full,
+    * (or a constructor throws) only the items before are inserted.
+    */
+    template< typename InputIt >
+    size_t push_bulk( InputIt first, InputIt last ) {
+        link chain = link(), end = link();
+        size_t count = 0;
+        try {
+            for ( ; first != last; ++first, ++count ) {
+                link toInsert = construct( *first );
+                if ( isNull( toInsert ) && !immediate && collect())
+                    toInsert = construct( *first );
+                if ( isNull( toInsert ))
+                    break;
+                if ( count )
+                    clear( end )->_next.store( toInsert, std::memory_order_relaxed );
+                else
+                    chain = toInsert;
+                end = toInsert;
             }
+        } catch ( ... ) {
+            //the items constructed before stay inserted
+            if ( count )
+                append( chain, end );
+            throw;
+        }
+        if ( count )
+            append( chain, end );
+        return count;
+    }
+
+    template< typename Range >
+    size_t push_bulk( Range&& range ) {
+        using std::begin;
+        using std::end;
+        return push_bulk( begin( range ), end( range ));
+    }
+
+    /*
+    * Method push_wait.
+    * inserts the item, if the memory pool is full, waits until some node
+    * is freed: tries push spin times, then the thread sleeps until
+    * a slot of the pool is released (see SlotPool::released).
+    * With deferred reclamation, the thread wakes up every millisecond
+    * to collect retired nodes, which are freed only by a scan, and so it
+    * does with magazines, which publish freed slots without a fence.
+    */
+    void push_wait( T value ) {
+        for ( size_t i = 0; i < spin; ++i ) {
+            if ( emplace( std::move( value )))
+                return;
+        }
+        auto& released = allocator.released();
+        while ( true ) {
+            auto key = released.prepare();
+            if ( emplace( std::move( value ))) {
+                released.cancel();
+                return;
+            }
+            if constexpr ( immediate && !Pool::parking )
+                released.wait( key );
+            else
+                released.wait_for( key, std::chrono::milliseconds( 1 ));
         }
     }
 
@@ -88,28 +203,49 @@ struct Queue {
     * Method pop
     * returns bool - if the item was successfully popped
     * pop fails only if the queue has been empty at given time
+    * The value is moved out of the node and destroyed there (copied
+    * with policy::Immediate, as it is read before the node is won).
     */
     bool pop( T& out ) {
+        Guard guard( _domain );
         while ( true ) {
             auto sentinel_f = head.load();
-            assert( sentinel_f != nullptr );
+            assert( !isNull( sentinel_f ));
             auto sentinel = clear( sentinel_f );
+            guard.protect( 0, sentinel );
+            if ( hazardPointers && sentinel_f != head )
+                continue;
             auto last_f = tail.load();
             auto first_f = sentinel->_next.load();
+            //the check of head below confirms also this protection
+            guard.protect( 1, isNull( first_f ) ? nullptr : clear( first_f ));
 
             if ( sentinel_f == head ) {
                 if ( sentinel_f == last_f ) {
-                    if ( first_f == nullptr ) {
+                    if ( isNull( first_f )) {
                         return false;
                     }
                     //help other thread to advance the tail of queue
                     tail.compare_exchange_weak( last_f, first_f );
+                } else if constexpr ( immediate ) {
+                    //once head moves, first can be popped and reused by other thread,
+                    //so the value is read before (the read is discarded if CAS fails)
+                    T value = clear( first_f )->value();
+                    if ( head.compare_exchange_weak( sentinel_f, first_f )) {
+                        out = value;
+                        retire( guard, sentinel_f );
+                        return true;
+                    }
                 } else {
+                    //deferred reclamation keeps first (the new sentinel)
+                    //from being reused until the guard is released
                     if ( head.compare_exchange_weak( sentinel_f, first_f )) {
-                        assert( first_f != nullptr );
+                        assert( !isNull( first_f ));
                         auto first = clear( first_f );
-                        out = first->_value;
-                        allocator.destruct( sentinel_f );
+                        out = std::move( first->value());
+                        first->destroyValue();
+                        guard.clear( 0 );
+                        retire( guard, sentinel_f );
                         return true;
                     }
                 }
@@ -117,19 +253,143 @@ struct Queue {
         }
     }
 
+    /*
+    * Method pop_bulk
+    * pops up to max items in their order to out, returns their number
+    * (0 if the queue has been empty). The nodes are claimed by one move
+    * of head over all of them (never beyond the tail seen), the former
+    * sentinels are then returned to the pool in batches.
+    */
+    template< typename OutputIt >
+    size_t pop_bulk( OutputIt out, size_t max ) {
+        static_assert( Pool::Backing::stable, "pop_bulk reads freed nodes, the slabs must stay while the pool exists" );
+        if ( !max )
+            return 0;
+        Guard guard( _domain );
+        while ( true ) {
+            auto sentinel_f = head.load();
+            assert( !isNull( sentinel_f ));
+            auto sentinel = clear( sentinel_f );
+            guard.protect( 0, sentinel );
+            if ( hazardPointers && sentinel_f != head )
+                continue;
+            auto last_f = tail.load();
+            auto first_f = sentinel->_next.load();
+
+            if ( sentinel_f != head )
+                continue;
+            if ( sentinel_f == last_f ) {
+                if ( isNull( first_f )) {
+                    return 0;
+                }
+                //help other thread to advance the tail of queue
+                tail.compare_exchange_weak( last_f, first_f );
+                continue;
+            }
+            if ( isNull( first_f ))
+                continue;
+
+            //nodes of other threads' pops may be read on the way, the CAS
+            //of head discards such walk; it is checked also every 64 nodes.
+            //Only the sentinel is protected, the nodes behind may be freed
+            //and reused meanwhile - reading them is safe as the slabs stay
+            //(and a reused node holds only valid links)
+            auto end_f = first_f;
+            size_t count = 1;
+            for ( ; count < max && end_f != last_f; ++count ) {
+                auto next_f = clear( end_f )->_next.load();
+                if ( isNull( next_f ) || ( count % 64 == 0 && sentinel_f != head ))
+                    break;
+                end_f = next_f;
+            }
+            //the last node becomes the sentinel, other nodes are not reachable after the CAS
+            guard.protect( 1, clear( end_f ));
+            if constexpr ( immediate ) {
+                //as in pop, the value of the new sentinel is read before,
+                //the nodes before it belong to this thread after the CAS
+                T value = clear( end_f )->value();
+                if ( head.compare_exchange_weak( sentinel_f, end_f )) {
+                    out = take( guard, sentinel_f, count, count - 1, out );
+                    *out++ = value;
+                    return count;
+                }
+            } else {
+                //the new sentinel stays protected until its value is moved out
+                if ( head.compare_exchange_weak( sentinel_f, end_f )) {
+                    guard.clear( 0 );
+                    take( guard, sentinel_f, count, count, out );
+                    return count;
+                }
+            }
+        }
+    }
+
+    /*
+    * Method pop_wait
+    * pops an item, if the queue is empty, waits until some is pushed:
+    * tries pop spin times, then the thread sleeps until a push.
+    * Pushes only check if a consumer waits (one load) otherwise.
+    */
+    void pop_wait( T& out ) {
+        for ( size_t i = 0; i < spin; ++i ) {
+            if ( pop( out ))
+                return;
+        }
+        while ( true ) {
+            auto key = _pushed.prepare();
+            if ( pop( out )) {
+                _pushed.cancel();
+                return;
+            }
+            _pushed.wait( key );
+        }
+    }
+
     bool empty() {
         return head == tail;
     }
 
-#if HOLDSIZE
+    // number of consumers sleeping in pop_wait (or about to)
+    size_t waiting() const {
+        return _pushed.waiting();
+    }
+
+    // number of nodes of this queue (including the sentinel), needs SizeTracking
     size_t used() {
-        return allocator._size;
+        static_assert( Pool::holdSize, "used() needs policy::SizeTracking" );
+        return _used.load();
     }
 
+    // number of free slots in the pool, which may be shared
     size_t available() {
-        return PoolAllocatorSize - allocator._size;
+        return allocator.available();
+    }
+
+    /*
+    * number of slots the pool has currently allocated memory for
+    */
+    size_t capacity() const {
+        return allocator.capacity();
+    }
+
+    Pool& pool() {
+        return allocator;
+    }
+
+    /*
+    * initializes (and thus faults in) the whole current pool
+    * using given number of threads, so first pushes do not pay for it
+    */
+    void prefault( size_t threads = 1 ) {
+        allocator.prefault( threads );
+    }
+
+    /*
+    * number of free slots held in per thread magazines
+    */
+    size_t parked() const {
+        return allocator.parked();
     }
-#endif
 
     /*
     * Destructor: expects that no thread access the queue
@@ -138,248 +398,248 @@ struct Queue {
     * undefined behaviour
     */
     ~Queue() {
-        auto fst_t = head.load();
-        while ( fst_t != nullptr ) {
-            auto fst = clear( fst_t );
-            auto next = fst->_next.load();
-            allocator.destruct( fst_t );
-            fst_t = next;
+        if constexpr ( epochs ) {
+            _domain.drain( this );
+        } else {
+            collect();
+        }
+        //values are held by the nodes after the sentinel
+        constexpr bool values = !std::is_trivially_destructible< T >::value;
+        if ( _owned ) {
+            //all used slots of the own pool are nodes of this queue
+            if constexpr ( values )
+                allocator.destroyValues( head.load( std::memory_order_relaxed ));
+        } else {
+            //shared pool gets the nodes back in batches
+            link batch[ Pool::max ];
+            size_t count = 0;
+            auto fst_t = head.load( std::memory_order_relaxed );
+            for ( bool sentinel = true; !isNull( fst_t ); sentinel = false ) {
+                auto current = clear( fst_t );
+                if ( values && !sentinel )
+                    current->destroyValue();
+                batch[ count++ ] = fst_t;
+                if ( count == Pool::max ) {
+                    destruct_n( batch, count );
+                    count = 0;
+                }
+                fst_t = current->_next.load( std::memory_order_relaxed );
+            }
+            destruct_n( batch, count );
         }
-        head = nullptr;
-        tail = nullptr;
+        head = link();
+        tail = link();
     }
 
 private:
 
     /*
-    * Pool allocator - the manager of memory in this queue
-    * The ability of not having a need to allocate new memory
-    * with malloc speeds up implementation.
-    * To make this allocator thread safe, the "allocation" is performed
-    * by setting an bit into atomic variable _flag.
-    * To prevent ABA problem, the pointer obtains a flag.
-    *
-    * If RANDOM is defined - the place, where an thread starts for looking
-    * for an empty place is selected randomly (uniformly)
-    *
-    * If SIZE is defined - the poolAllocator holds it's size - this can slower
-    * the impl, as every thread need to access this variable many times
+    * With immediate reclamation the guard does nothing and the popped
+    * sentinel is returned to the pool right away.
     */
+    struct NoDomain {
+        explicit NoDomain( size_t ) {
+        }
+    };
 
-    template< std::size_t size, typename Allocator = std::allocator< node>>
-    class PoolAllocator {
-    public:
-
-        using value_type = node;
-        using pointer = node *;
-        // the number of bits in one size_t (expects to be 64)
-        static constexpr size_t max = sizeof( size_t ) * 8;
-        // number of chunks of atomic flags needed
-        static constexpr size_t chunks = size / max;
-
-        PoolAllocator() : _data( Allocator{ }.allocate( size )),
-#if HOLDSIZE
-                		  _size(0),
-#endif
-#if RANDOM
-                          generator(),
-                          distribution( 0, size )
-#else
-                          _start(0)
-#endif
-        {
-
-            static_assert(( size % max ) == 0, "The size of PoolAllocator must be multiple of 64" );
-            assert( _data );
-
-            //clear flags
-            for ( size_t i = 0; i < chunks; ++i ) {
-                _flags[ i ] = 0;
-            }
+    struct NoGuard {
+        explicit NoGuard( NoDomain& ) {
+        }
 
-            //the data holds it's last flag for pointers: need to be set to 0 at the begining
-            for (size_t i = 0; i < size; ++i) {
-                int *flagHolder = reinterpret_cast<int *>(_data + i);
-                *flagHolder = 0;
-            }
+        void protect( size_t, const void * ) {
         }
 
-        pointer allocate() {
-#if HOLDSIZE
-            //eliminates threads from looking for empty place
-            // in case that memory is full. happens mostly if
-            // the size of queue is too small
-            size_t freeSpace = size - _size.fetch_add(1) - 1;
-            if (freeSpace <= 1) {
-                --_size;
-                return nullptr;
-            }
-#endif
-
-#if RANDOM
-            size_t hint = distribution(generator);
-#else
-            size_t hint = _start.fetch_add( 1 );
-            hint %= size;
-#endif
-            while ( true ) {
-                size_t chunkOfft = hint / max;
-                for ( size_t i = chunkOfft; i < chunks + chunkOfft; ++i ) {
-                    size_t chunk = i % chunks;
-                    size_t value = 1;
-                    size_t position = 0;
-                    while ( position < hint % max ) {
-                        value <<= 1;
-                        ++position;
-                    }
-                    hint = 0; //next round continue with position 0
-                    while ( position < max ) {
-                        auto previous = _flags[ chunk ].fetch_or( value );
-                        if ( previous & value ) {
-                            value <<= 1;
-                            ++position;
-                        } else {
-                            //got my allocated _data;
-                            return _data + ( chunk * max + position );
-                        }
+        void clear( size_t ) {
+        }
+    };
+
+    using Domain = std::conditional_t< hazardPointers, hazard::Domain< 2 >,
+                   std::conditional_t< epochs, epoch::Domain&, NoDomain >>;
+    using Guard = std::conditional_t< hazardPointers, typename hazard::Domain< 2 >::Guard,
+                  std::conditional_t< epochs, epoch::Domain::Guard, NoGuard >>;
+
+    // the pool of the queue, if it does not use a shared one
+    std::unique_ptr< Pool > _owned;
+    Pool& allocator;
+    // nodes of this queue, kept only with SizeTracking, away from head and tail
+    alignas( 64 ) typename Pool::Counter _used;
+    std::atomic< link > head, tail;
+    // declared after the allocator, as it returns retired nodes in destructor
+    Domain _domain;
+    // consumers sleeping in pop_wait, notified by pushes only while some wait
+    alignas( 64 ) EventCount _pushed;
+
+    Queue( Pool *owned, Pool *shared, epoch::Domain& domain ) : _owned( owned ),
+                                                                allocator( shared ? *shared : *owned ),
+                                                                _used(),
+                                                                head( construct( detail::Hollow())),
+                                                                tail( head.load()),
+                                                                _domain( makeDomain( domain )) {
+        if ( isNull( head.load( std::memory_order_relaxed )))
+            throw std::bad_alloc();
+    }
+
+    template< class... Args >
+    link construct( Args&& ... args ) {
+        link l = allocator.construct( std::forward< Args >( args )... );
+        if ( Pool::holdSize && !isNull( l ))
+            Pool::account( _used, 1 );
+        return l;
+    }
+
+    void destruct( link l ) {
+        allocator.destruct( l );
+        if constexpr ( Pool::holdSize )
+            Pool::account( _used, -1 );
+    }
+
+    void destruct_n( const link *links, size_t count ) {
+        allocator.destruct_n( links, count );
+        if constexpr ( Pool::holdSize )
+            Pool::account( _used, -ptrdiff_t( count ));
+    }
+
+    /*
+    * links the chain of nodes from first to last (already linked
+    * together by _next) behind the last node of the queue
+    */
+    void append( link first, link last ) {
+        Guard guard( _domain );
+        while ( true ) {
+            auto last_f = tail.load();
+            auto tail_n = clear( last_f );
+            guard.protect( 0, tail_n );
+            if ( hazardPointers && last_f != tail )
+                continue;
+            auto next_f = tail_n->_next.load();
+
+            if ( last_f == tail ) {
+                if ( isNull( next_f )) {
+                    //try to add the chain as last
+                    if ( tail_n->_next.compare_exchange_weak( next_f, first )) {
+                        //I was successful, so try to make its end the new tail
+                        tail.compare_exchange_weak( last_f, last );
+                        //if i hasn't been successful it means, that some other node becomes tail
+                        //the seq_cst CAS above published the chain (see EventCount)
+                        if ( first == last )
+                            _pushed.notify_one();
+                        else
+                            _pushed.notify_all();
+                        return;
                     }
+                } else {
+                    //help other node to become a tail
+                    tail.compare_exchange_weak( last_f, next_f );
                 }
-#if HOLDSIZE
-                --_size;
-#endif
-                return nullptr;
             }
-            return nullptr;
-        }
-
-        bool operator==( const PoolAllocator& other ) const {
-            return other == *this;
         }
+    }
 
-        bool operator!=( const PoolAllocator& other ) const {
-            return !( *this == other );
+    static Domain makeDomain( epoch::Domain& shared ) {
+        if constexpr ( epochs ) {
+            return shared;
+        } else {
+            ( void ) shared;
+            return Domain( Reclamation::threshold );
         }
+    }
 
-        /*
-        * firstly, allocates (obtains) a new space in memory
-        * secondly, constructs object with given arguments.
-        * similar to emplace_back on vector.
-        * flag is set, before returning an pointer.
-        */
-        template< class... Args >
-        pointer construct( Args&& ... args ) {
-            auto data = allocate();
-            if ( !data )
-                return nullptr;
-
-            int lastFlag = *reinterpret_cast<int *>(data);
-            new( data ) node( std::forward< Args >( args )... );
-
-            data = addFlag( data, static_cast<size_t >(lastFlag + 1) );
-            return data;
+    void retire( Guard& guard, link l ) {
+        if constexpr ( hazardPointers ) {
+            _domain.retire( guard, clear( l ), toValue( l ), this, &Queue::reclaim );
+        } else if constexpr ( epochs ) {
+            _domain.retire( guard, toValue( l ), this, &Queue::reclaim );
+        } else {
+            ( void ) guard;
+            destruct( l );
         }
+    }
 
-        /*
-        * firstly, clear pointer from its flag
-        * secondly, call destructor on data,
-        * and stores last flag for nex allocation
-        * afterwards, the flag on allocated data is set to 0
-        * this indicates that the memory is again available
-        */
-        void destruct( pointer data ) {
-            int flag = 0;
-            std::tie( data, flag ) = clearFlag( data );
-            auto distance = data - _data;
-            auto chunk = distance / max;
-            auto position = distance % max;
-            size_t binary = 1;
-            for ( size_t i = 0; i < position; ++i ) {
-                binary <<= 1;
+    /*
+    * retires count nodes from sentinel_f on, claimed by pop_bulk (freed
+    * immediately ones go back to the pool in batches), and moves the values
+    * of the first values nodes after sentinel_f to out; returns the iterator after.
+    * Immediate reclamation lets other pops reuse the new sentinel, so its value
+    * is never moved here then.
+    */
+    template< typename OutputIt >
+    OutputIt take( Guard& guard, link sentinel_f, size_t count, size_t values, OutputIt out ) {
+        assert( !immediate || values < count );
+        link batch[ Pool::max ];
+        size_t freed = 0;
+        auto current_f = sentinel_f;
+        for ( size_t i = 0; i < count; ++i ) {
+            auto next_f = clear( current_f )->_next.load( std::memory_order_relaxed );
+            if ( i < values ) {
+                auto next = clear( next_f );
+                *out++ = std::move( next->value());
+                next->destroyValue();
             }
-
-            destroy_at<node>( data );
-            int *storeLastFlag = reinterpret_cast<int *>(data);
-            *storeLastFlag = flag;
-            _flags[ chunk ] &= ( ~binary );
-#if HOLDSIZE
-            --_size;
-#endif
-        }
-
-        ~PoolAllocator() {
-            //destroy unpoped values first
-            for (size_t i = 0; i < chunks; ++i ) {
-            	size_t value = 1;
-                size_t position = 0;
-                while( position < max ) {
-                    if ( _flags[i] &  value ) {
-                        destruct(_data + (i * max + position));
-                    }
-                    value <<= 1;
-                    ++position;
+            if constexpr ( immediate ) {
+                batch[ freed++ ] = current_f;
+                if ( freed == Pool::max ) {
+                    destruct_n( batch, freed );
+                    freed = 0;
                 }
-                assert(_flags[i] == 0);
+            } else {
+                retire( guard, current_f );
             }
-            Allocator{ }.deallocate( _data, size );
+            current_f = next_f;
         }
-
-    private:
-        pointer _data;
-        friend Queue;
-        std::atomic< size_t > _flags[size / max];
-#if HOLDSIZE
-        std::atomic<size_t> _size;
-#endif
-
-#if RANDOM
-        std::default_random_engine generator;
-        std::uniform_int_distribution< int > distribution;
-#else
-        std::atomic< size_t > _start;
-#endif
-        /*
-        * adds flag to pointer to node, defined by number % 3
-        * as the flag is set to the two low bits, which are available to this
-        * usage thaks to aligned memory, the flags can be only [0,3]
-        */
-        node *addFlag( node *in, size_t number = 1 ) {
-            number %= 3;
-            uintptr_t pointer = reinterpret_cast<uintptr_t>(in);
-            pointer |= number;
-            return reinterpret_cast<node *>(pointer);
+        if constexpr ( immediate ) {
+            ( void ) guard;
+            destruct_n( batch, freed );
         }
+        return out;
+    }
 
-        /*
-        * clears the flag from a pointer to node, and returns this flag.
-        * expects the flag only on 2 low bits.
-        */
-        std::pair< node *, int > clearFlag( node *toClear ) {
-            uintptr_t pointer = reinterpret_cast<uintptr_t>(toClear);
-            uintptr_t clearFlag = 0xFFFFFFFFFFFFFFFC;
+    // reclaims all retired nodes, which are not protected
+    size_t collect() {
+        if constexpr ( !immediate ) {
+            return _domain.collect();
+        } else {
+            return 0;
+        }
+    }
 
-            int flag = static_cast<int>(pointer & ( ~clearFlag ));
+    static void reclaim( void *queue, uintptr_t value ) {
+        static_cast< Queue * >( queue )->destruct( fromValue( value ));
+    }
 
-            pointer &= clearFlag;
-            return { reinterpret_cast<node *>(pointer), flag };
+    static uintptr_t toValue( link l ) {
+        if constexpr ( handles ) {
+            return static_cast< uintptr_t >( l );
+        } else {
+            return reinterpret_cast< uintptr_t >( l );
         }
-    };
+    }
 
-    PoolAllocator< PoolAllocatorSize > allocator;
-    std::atomic< node * > head, tail;
+    static link fromValue( uintptr_t value ) {
+        if constexpr ( handles ) {
+            return static_cast< link >( value );
+        } else {
+            return reinterpret_cast< link >( value );
+        }
+    }
 
     /*
-   * clears the flag from a pointer to node.
-   * expects the flag only on 2 low bits
+   * clears the flag from a link to node.
    * used by queue directly, when the pointer need
    * to be dereferenced
    */
-    node *clear( node *toClear ) {
-        uintptr_t pointer = reinterpret_cast<uintptr_t>(toClear);
-
-        uintptr_t clearFlag = 0xFFFFFFFFFFFFFFFC;
+    node *clear( link toClear ) {
+        return allocator.get( toClear );
+    }
 
-        pointer &= clearFlag;
-        return reinterpret_cast<node *>(pointer);
+    /*
+    * null link in handle mode may carry a generation
+    */
+    static bool isNull( link l ) {
+        if constexpr ( handles ) {
+            return ( l & 0xFFFFFFFF ) == 0;
+        } else {
+            return l == nullptr;
+        }
     }
 };
 
@@ -0,0 +1,592 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <array>
+#include <thread>
+#include <cstdint>
+#include <type_traits>
+#include <cassert>
+
+#include "bitmap.h"
+#include "policy.h"
+#include "../thread_index.h"
+#include "../event_count.h"
+
+namespace lockfree {
+namespace memPool {
+
+/*
+* SlotPool - fixed size slots of type Slot, handed out by index
+* The ability of not having a need to allocate new memory
+* with malloc speeds up implementation.
+* To make this allocator thread safe, the "allocation" is performed
+* by setting an bit in the hierarchical bitmap _flags, which finds
+* a free bit in a few steps even if the pool is nearly full.
+* Nothing is constructed in the slots, they are just memory.
+*
+* The place, where a thread starts looking for an empty slot,
+* is chosen by the hint policy (sequential by default, see policy.h).
+*
+* With the SizeTracking policy the pool holds it's size - this can slower
+* the impl, as every thread need to access this variable many times
+*
+* With the Magazines policy, threads allocate from and free to their own
+* magazine, which exchanges slots with the bitmap in batches. When the
+* bitmap is exhausted, slots parked in other magazines are taken, so
+* allocation fails only if the whole pool is really used (or its last
+* free slots are just being moved by the owner of their magazine).
+* No thread ever waits for another: a busy magazine is passed by (own one
+* is busy only while other thread steals from it) and the bitmap is used
+* instead, so the pool stays lock free with magazines as well.
+*
+* The memory consists of slabs. The pool starts with one slab of size slots
+* and when it is exhausted, a new slab as big as all previous together
+* is appended, until the pool holds limit slots. The bitmap covers
+* the whole limit, slots of missing slabs are marked as taken.
+* Slab k starts at index (size << k) / 2, so the slab of an index is
+* found by its highest bit, and the slab of a pointer by walking the short
+* directory of slabs (there are at most log2( limit / size ) + 1 of them).
+*
+* Slabs are obtained from std::allocator by default,
+* from HugePageAllocator with the HugePages policy.
+*
+* With the Statistics policy the pool counts allocations, failures,
+* probe lengths and collisions in the bitmap and the peak of used slots,
+* see statistics().
+*
+* Threads may wait for a slot being freed on released() (see EventCount),
+* every deallocation notifies them - by a single load, if nobody waits.
+*
+* Pool (the nodes of memPool queues) and FixedPool (single objects for
+* containers) are built on it.
+*/
+template< typename Slot, typename... Policies >
+class SlotPool {
+public:
+    using Magazines = policy::select_t< policy::magazines, policy::NoMagazines, Policies... >;
+    using Backing = policy::select_t< policy::backing, policy::Heap, Policies... >;
+    using Hint = policy::select_t< policy::hint, policy::SequentialHint, Policies... >;
+    using Sizing = policy::select_t< policy::sizing, policy::NoSizeTracking, Policies... >;
+    using Layout = policy::select_t< policy::layout, policy::PackedFlags, Policies... >;
+    using Statistics = policy::select_t< policy::statistics, policy::NoStatistics, Policies... >;
+
+    static constexpr bool holdSize = Sizing::enabled;
+    // freed slots may be parked in magazines (see released)
+    static constexpr bool parking = Magazines::threads > 0;
+    static constexpr bool sharded = Sizing::sharded;
+    // counter of used slots (std::atomic or ShardedCounter)
+    using Counter = typename Sizing::Counter;
+
+    using Allocator = typename Backing::template allocator< Slot >;
+    using pointer = Slot *;
+    // the number of bits in one size_t (expects to be 64)
+    static constexpr size_t max = sizeof( size_t ) * 8;
+    // slabs double the pool, so 64 of them cover any size
+    static constexpr size_t maxSlabs = 64;
+
+    /*
+    * Pool of size slots, which can grow up to limit slots.
+    * Both are rounded up to multiple of 64, limit is at least size.
+    */
+    explicit SlotPool( size_t size, size_t limit = 0 ) : _base( roundUp( size )),
+                                                         _limit( std::max( roundUp( limit ), _base )),
+                                                         _slabCount( slabCount( _base, _limit )),
+                                                         _data( Allocator{ }.allocate( _base )),
+                                                         _flags( _limit, _base ),
+                                                         _slabs( 1 ),
+                                                         _claimed( 1 ),
+                                                         _size() {
+        assert( size > 0 );
+        assert( _data );
+
+        _directory[ 0 ] = _data;
+        for ( size_t i = 1; i < maxSlabs; ++i ) {
+            _directory[ i ] = nullptr;
+        }
+        placed( _data, 0, _base );
+    }
+
+    SlotPool( const SlotPool& ) = delete;
+    SlotPool& operator=( const SlotPool& ) = delete;
+
+    /*
+    * obtains a free slot, returns its index or Bitmap::npos
+    */
+    size_t allocate() {
+        if constexpr ( sharded ) {
+            if ( exhausted()) {
+                _stats.failed();
+                return Bitmap::npos;
+            }
+        } else if constexpr ( holdSize ) {
+            //eliminates threads from looking for empty place
+            // in case that memory is full. happens mostly if
+            // the size of queue is too small
+            size_t freeSpace = _limit - _size.fetch_add(1) - 1;
+            if (freeSpace <= 1) {
+                --_size;
+                _stats.failed();
+                return Bitmap::npos;
+            }
+        }
+
+        auto probe = _stats.probe();
+        size_t index = take( probe );
+        while ( index == Bitmap::npos && grow() )
+            index = take( probe );
+        if constexpr ( sharded ) {
+            if ( index != Bitmap::npos )
+                _size.add( 1 );
+        } else if ( holdSize && index == Bitmap::npos ) {
+            --_size;
+        }
+        if ( index == Bitmap::npos )
+            _stats.failed();
+        else
+            _stats.allocated( probe, 1 );
+        return index;
+    }
+
+    /*
+    * obtains up to count (at most 64) free slots from one word of the bitmap
+    * by a single atomic operation, bypassing magazines. Writes their indices
+    * to out and returns their number, 0 if the pool is full.
+    */
+    size_t allocate_n( size_t count, size_t *out ) {
+        count = std::min( count, max );
+        if constexpr ( sharded ) {
+            if ( exhausted()) {
+                _stats.failed();
+                return 0;
+            }
+        } else if constexpr ( holdSize ) {
+            size_t previous = _size.fetch_add( count );
+            if ( previous + count + 2 > _limit ) {
+                //keeps the same reserve as allocate
+                size_t allowed = previous + 2 < _limit ? _limit - previous - 2 : 0;
+                _size -= count - allowed;
+                count = allowed;
+                if ( !count ) {
+                    _stats.failed();
+                    return 0;
+                }
+            }
+        }
+        auto probe = _stats.probe();
+        size_t taken = _flags.acquire( hint( count ), count, out, probe );
+        while ( !taken && grow() )
+            taken = _flags.acquire( hint( count ), count, out, probe );
+        if constexpr ( sharded )
+            _size.add( ptrdiff_t( taken ));
+        else if ( holdSize && taken < count )
+            _size -= count - taken;
+        if ( taken )
+            _stats.allocated( probe, taken );
+        else
+            _stats.failed();
+        return taken;
+    }
+
+    /*
+    * returns a slot obtained by allocate, which holds no object
+    */
+    void deallocate( size_t index ) {
+        give( index );
+        if constexpr ( holdSize )
+            account( _size, -1 );
+        _stats.released( 1 );
+        signal( 1 );
+    }
+
+    /*
+    * returns count slots obtained by allocate_n, which hold no objects,
+    * directly to the bitmap - one atomic operation per word
+    */
+    void deallocate_n( const size_t *indices, size_t count ) {
+        if ( count )
+            _hint.freed( indices[ 0 ] );
+        _flags.release( indices, count );
+        if constexpr ( holdSize )
+            account( _size, -ptrdiff_t( count ));
+        _stats.released( count );
+        signal( count );
+    }
+
+    bool operator==( const SlotPool& other ) const {
+        return this == &other;
+    }
+
+    bool operator!=( const SlotPool& other ) const {
+        return !( *this == other );
+    }
+
+    /*
+    * number of slots used by all users of the pool, needs SizeTracking
+    * or ShardedSize (approximate with its Batch)
+    */
+    size_t used() const {
+        static_assert( holdSize, "used() needs policy::SizeTracking" );
+        return _size.load();
+    }
+
+    size_t available() const {
+        static_assert( holdSize, "available() needs policy::SizeTracking" );
+        size_t taken = used();
+        return taken < _limit ? _limit - taken : 0;
+    }
+
+    // adds delta to a counter of used slots of the pool type
+    static void account( Counter& counter, ptrdiff_t delta ) {
+        if constexpr ( sharded )
+            counter.add( delta );
+        else
+            counter.fetch_add( size_t( delta ));
+    }
+
+    // number of slots the pool has currently allocated memory for
+    size_t capacity() const {
+        return slabBase( _slabs.load());
+    }
+
+    // the maximal number of slots the pool can grow to
+    size_t limit() const {
+        return _limit;
+    }
+
+    // number of free slots held in per thread magazines
+    size_t parked() const {
+        size_t count = 0;
+        for ( auto& magazine : _magazines ) {
+            count += magazine._count.load( std::memory_order_relaxed );
+        }
+        return count;
+    }
+
+    /*
+    * sums the statistics of all threads, needs policy::Statistics
+    */
+    auto statistics() {
+        static_assert( Statistics::enabled, "statistics() needs policy::Statistics" );
+        return _stats.snapshot();
+    }
+
+    /*
+    * event notified when a slot is freed, for threads waiting for one:
+    * prepare, allocate again and wait, if it fails. With parking, a slot
+    * freed to a magazine may be missed for a moment, so waiters should
+    * wait_for a short time rather than wait.
+    */
+    EventCount& released() {
+        return _released;
+    }
+
+    // the slot of an allocated index
+    pointer address( size_t index ) const {
+        if ( index < _base )
+            return _data + index;
+        size_t slab = slabOf( index );
+        return _directory[ slab ].load( std::memory_order_relaxed ) + ( index - slabBase( slab ));
+    }
+
+    // index of a slot of the pool
+    size_t indexOf( const Slot *data ) const {
+        auto position = reinterpret_cast< uintptr_t >( data );
+        for ( size_t i = _slabCount; i-- > 1; ) {
+            auto begin = reinterpret_cast< uintptr_t >( _directory[ i ].load( std::memory_order_relaxed ));
+            if ( begin && position - begin < slabSize( i ) * sizeof( Slot ))
+                return slabBase( i ) + ( position - begin ) / sizeof( Slot );
+        }
+        return data - _data;
+    }
+
+    // whether memory belongs to one of the slabs
+    bool contains( const void *data ) const {
+        auto position = reinterpret_cast< uintptr_t >( data );
+        for ( size_t i = 0; i < _slabCount; ++i ) {
+            auto begin = reinterpret_cast< uintptr_t >( _directory[ i ].load( std::memory_order_relaxed ));
+            if ( begin && position - begin < slabSize( i ) * sizeof( Slot ))
+                return true;
+        }
+        return false;
+    }
+
+    /*
+    * frees the slabs, objects left in the slots are not destroyed
+    */
+    ~SlotPool() {
+        for ( size_t i = 0; i < _slabCount; ++i ) {
+            if ( pointer slab = _directory[ i ] )
+                Allocator{ }.deallocate( slab, slabSize( i ));
+        }
+    }
+
+protected:
+    // size of the first slab
+    size_t _base;
+    size_t _limit;
+
+    // the slab holding the slot of index
+    size_t slabOf( size_t index ) const {
+        return index < _base ? 0 : 64 - __builtin_clzll( index / _base );
+    }
+
+    size_t slabBase( size_t slab ) const {
+        return slab ? ( _base << slab ) / 2 : 0;
+    }
+
+    size_t slabSize( size_t slab ) const {
+        size_t end = _base << slab;
+        return ( end < _limit ? end : _limit ) - slabBase( slab );
+    }
+
+    /*
+    * returns all slots parked in magazines to the bitmap;
+    * no other thread may use the pool
+    */
+    void flush() {
+        for ( auto& magazine : _magazines ) {
+            flush( magazine, magazine._count );
+        }
+    }
+
+    /*
+    * calls visit with index of every used slot, found by ctz over the words
+    * of the bitmap, which is not changed; no other thread may use the pool
+    * and magazines must be flushed
+    */
+    template< typename Visit >
+    void occupied( Visit visit ) const {
+        size_t words = capacity() / max;
+        for ( size_t i = 0; i < words; ++i ) {
+            for ( size_t bits = _flags.word( i ); bits; bits &= bits - 1 )
+                visit( i * max + static_cast< size_t >( __builtin_ctzll( bits )));
+        }
+    }
+
+private:
+    /*
+    * per thread stack of free slots, claimed in the bitmap.
+    * _busy is taken by the owner on every access - it is uncontended,
+    * except when other thread steals from the magazine. It is only
+    * ever tried: whoever finds it taken turns to the bitmap.
+    */
+    struct alignas( 64 ) Magazine {
+        std::atomic< bool > _busy{ false };
+        std::atomic< size_t > _count{ 0 };
+        std::array< size_t, Magazines::capacity > _slots;
+
+        bool try_lock() {
+            return !_busy.load( std::memory_order_relaxed ) && !_busy.exchange( true, std::memory_order_acquire );
+        }
+
+        void unlock() {
+            _busy.store( false, std::memory_order_release );
+        }
+    };
+
+    static constexpr size_t batch = Magazines::capacity / 2 ? Magazines::capacity / 2 : 1;
+
+    // the number of slabs in the fully grown pool
+    size_t _slabCount;
+    pointer _data;
+    BasicBitmap< Layout > _flags;
+    std::atomic< size_t > _slabs;
+    // slabs, which are created or being created by some thread
+    std::atomic< size_t > _claimed;
+    std::array< std::atomic< pointer >, maxSlabs > _directory;
+    std::array< Magazine, Magazines::threads > _magazines;
+    // written by every allocation, so each has a cache line of its own,
+    // away from the read mostly members above (and from each other)
+    // the number of used slots, kept only with SizeTracking or ShardedSize
+    alignas( 64 ) Counter _size;
+    alignas( 64 ) typename Hint::State _hint;
+    typename Statistics::State _stats;
+    // read by every deallocation, written only by waiting threads
+    alignas( 64 ) EventCount _released;
+
+    static size_t roundUp( size_t count ) {
+        return ( count + max - 1 ) / max * max;
+    }
+
+    static size_t slabCount( size_t size, size_t limit ) {
+        size_t count = 1;
+        for ( size_t covered = size; covered < limit; covered *= 2 )
+            ++count;
+        return count;
+    }
+
+    /*
+    * full pool is recognized without any shared counter: by the top word
+    * of the bitmap summary (one load), if no slot can be parked in
+    * a magazine and the pool cannot grow anymore
+    */
+    bool exhausted() const {
+        return Magazines::threads == 0 && _slabs.load( std::memory_order_relaxed ) == _slabCount
+               && _flags.exhausted();
+    }
+
+    size_t hint( size_t count = 1 ) {
+        return _hint.next( count, capacity());
+    }
+
+    /*
+    * wakes threads waiting for count freed slots. A slot freed to the bitmap
+    * is published by a seq_cst RMW already, a slot parked in a magazine
+    * only by the release of its lock. The fence is paid only if somebody
+    * seems to wait: a waiter registered just now may miss the slot,
+    * until it wakes up by its timeout (see released).
+    */
+    void signal( size_t count ) {
+        if constexpr ( parking ) {
+            if ( !_released.waiting())
+                return;
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+        }
+        if ( count == 1 )
+            _released.notify_one();
+        else if ( count > 1 )
+            _released.notify_all();
+    }
+
+    /*
+    * appends the next slab, if the pool can still grow.
+    * Returns false if the pool has its limit already.
+    * The slab is claimed first, so only one thread allocates (maps) it.
+    * Its bits are released only by that thread, once it has published
+    * the slab - others yield and retry the allocation meanwhile.
+    */
+    bool grow() {
+        size_t slab = _slabs.load();
+        if ( slab == _slabCount )
+            return false;
+        size_t expected = slab;
+        if ( !_claimed.compare_exchange_strong( expected, slab + 1 )) {
+            std::this_thread::yield();
+            return true;
+        }
+        pointer memory;
+        try {
+            memory = Allocator{ }.allocate( slabSize( slab ));
+        } catch ( ... ) {
+            _claimed.store( slab );
+            throw;
+        }
+        _directory[ slab ].store( memory );
+        placed( memory, slabBase( slab ), slabSize( slab ));
+        _flags.release( slabBase( slab ), slabBase( slab ) + slabSize( slab ));
+        _slabs.store( slab + 1 );
+        return true;
+    }
+
+    // tells the hint about a new slab (see policy::NumaHint)
+    void placed( pointer memory, size_t begin, size_t count ) {
+        if constexpr ( policy::detail::places< typename Hint::State >::value )
+            _hint.placed( memory, begin, count );
+        else {
+            ( void ) memory;
+            ( void ) begin;
+            ( void ) count;
+        }
+    }
+
+    Magazine *magazine() {
+        size_t thread = threadIndex();
+        return thread < _magazines.size() ? &_magazines[ thread ] : nullptr;
+    }
+
+    /*
+    * obtains index of a free slot - from own magazine if there is one
+    * (and no other thread steals from it right now), otherwise from
+    * the bitmap, or at last from magazines of others
+    */
+    template< typename Probe >
+    size_t take( Probe& probe ) {
+        Magazine *own = magazine();
+        if ( own && own->try_lock()) {
+            size_t count = own->_count.load( std::memory_order_relaxed );
+            if ( count == 0 )
+                count = refill( *own, probe );
+            size_t index = Bitmap::npos;
+            if ( count ) {
+                index = own->_slots[ --count ];
+                own->_count.store( count, std::memory_order_relaxed );
+            }
+            own->unlock();
+            if ( index != Bitmap::npos )
+                return index;
+        }
+
+        size_t index;
+        if ( !_flags.acquire( hint(), 1, &index, probe ))
+            index = steal();
+        return index;
+    }
+
+    /*
+    * returns index of a freed slot - to own magazine if there is one
+    * (and no other thread steals from it right now), otherwise to the bitmap
+    */
+    void give( size_t index ) {
+        _hint.freed( index );
+        Magazine *own = magazine();
+        if ( own && own->try_lock()) {
+            size_t count = own->_count.load( std::memory_order_relaxed );
+            if ( count == Magazines::capacity ) {
+                flush( *own, batch );
+                count -= batch;
+            }
+            own->_slots[ count ] = index;
+            own->_count.store( count + 1, std::memory_order_relaxed );
+            own->unlock();
+            return;
+        }
+        _flags.release( index );
+    }
+
+    // expects locked magazine, returns the new count
+    template< typename Probe >
+    size_t refill( Magazine& magazine, Probe& probe ) {
+        size_t count = 0;
+        size_t start = hint( batch );
+        while ( count < batch ) {
+            size_t taken = _flags.acquire( start + count, batch - count, &magazine._slots[ count ], probe );
+            if ( !taken )
+                break;
+            count += taken;
+        }
+        magazine._count.store( count, std::memory_order_relaxed );
+        return count;
+    }
+
+    // expects locked magazine (or no other thread accessing it)
+    void flush( Magazine& magazine, size_t count ) {
+        size_t current = magazine._count.load( std::memory_order_relaxed );
+        //slots taken by one refill are next to each other, so mostly one word is released at once
+        _flags.release( &magazine._slots[ current - count ], count );
+        magazine._count.store( current - count, std::memory_order_relaxed );
+    }
+
+    /*
+    * the bitmap is exhausted, take a slot parked in any magazine,
+    * which is not busy
+    */
+    size_t steal() {
+        for ( auto& magazine : _magazines ) {
+            if ( !magazine._count.load( std::memory_order_relaxed ) || !magazine.try_lock())
+                continue;
+            size_t count = magazine._count.load( std::memory_order_relaxed );
+            size_t index = Bitmap::npos;
+            if ( count ) {
+                index = magazine._slots[ --count ];
+                magazine._count.store( count, std::memory_order_relaxed );
+            }
+            magazine.unlock();
+            if ( index != Bitmap::npos )
+                return index;
+        }
+        return Bitmap::npos;
+    }
+};
+
+} //namespace memPool
+} //namespace lockfree
@@ -0,0 +1,303 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <new>
+#include <cassert>
+
+#include "../thread_index.h"
+
+namespace lockfree {
+namespace epoch {
+
+/*
+* Epoch based reclamation domain
+* A thread accesses shared objects only inside a critical section (Guard),
+* which announces the global epoch the thread has seen. The global epoch
+* advances only when all threads inside critical sections have announced
+* the current one. Object retired in epoch e can not be reached by any
+* thread once the global epoch is e + 2.
+*
+* Retired objects wait in three limbo lists of the retiring thread, one per
+* epoch modulo 3. When a thread retires into a list holding objects from
+* an older epoch, the whole list is reclaimed at once. Every threshold
+* retirements the thread tries to advance the global epoch.
+*
+* The first guard of a record reserves threshold entries in every limbo
+* list. A full list grows before the object is added, and if there is no
+* memory for it, the thread waits for the next epoch, which empties the
+* list of that epoch - retire never throws after the object was unlinked.
+*
+* One domain can be shared by any number of data structures, objects are
+* told apart by the context given to retire. Records are indexed by
+* lockfree::threadIndex(); threads above maxThreads share one more record,
+* which they hold exclusively for the whole guard (so they must not nest
+* guards).
+*/
+class Domain {
+public:
+    // called with the context and value given to retire
+    using reclaimer = void (*)( void *context, uintptr_t value );
+
+private:
+    struct Retired {
+        uintptr_t value;
+        void *context;
+        reclaimer reclaim;
+    };
+
+    struct Limbo {
+        size_t epoch = 0;
+        std::vector< Retired > retired;
+    };
+
+    /*
+    * _state is the announced epoch shifted by one, with the low bit set
+    * while the owner is inside a critical section.
+    * _busy guards limbo lists - taken by the owner on every retire,
+    * contended only if other thread collects or drains.
+    */
+    struct alignas( 64 ) Record {
+        std::atomic< size_t > _state{ 0 };
+        std::atomic< bool > _busy{ false };
+        std::atomic< bool > _owned{ false };
+        size_t _nesting = 0;
+        size_t _retires = 0;
+        // set (and read) only by the thread holding the record
+        bool _prepared = false;
+        std::array< Limbo, 3 > _limbo;
+
+        void lock() {
+            while ( _busy.exchange( true, std::memory_order_acquire )) { }
+        }
+
+        void unlock() {
+            _busy.store( false, std::memory_order_release );
+        }
+    };
+
+public:
+
+    /*
+    * Critical section of the calling thread. Guards can be nested.
+    */
+    class Guard {
+    public:
+        explicit Guard( Domain& domain ) : _domain( domain ), _index( threadIndex()) {
+            if ( _index >= maxThreads ) {
+                _index = maxThreads;
+                while ( _domain._records[ _index ]._owned.exchange( true, std::memory_order_acquire )) { }
+            }
+            _record = &_domain._records[ _index ];
+            _domain.activate( _index );
+            if ( !_record->_prepared )
+                _domain.prepare( *_record );
+            if ( _record->_nesting++ == 0 )
+                _record->_state.store(( _domain._epoch.load() << 1 ) | 1 );
+        }
+
+        Guard( const Guard& ) = delete;
+        Guard& operator=( const Guard& ) = delete;
+
+        // epoch does not protect single objects, kept for uniform use with hazard pointers
+        void protect( size_t, const void * ) {
+        }
+
+        void clear( size_t ) {
+        }
+
+        ~Guard() {
+            if ( --_record->_nesting == 0 )
+                _record->_state.store( 0, std::memory_order_release );
+            if ( _index == maxThreads )
+                _record->_owned.store( false, std::memory_order_release );
+        }
+
+    private:
+        friend Domain;
+        Domain& _domain;
+        size_t _index;
+        Record *_record;
+    };
+
+    // threshold 0 is taken as 1 (an attempt to advance on every retire)
+    explicit Domain( size_t threshold = 64 ) : _threshold( threshold ? threshold : 1 ), _epoch( 0 ), _active( 0 ) {
+    }
+
+    Domain( const Domain& ) = delete;
+    Domain& operator=( const Domain& ) = delete;
+
+    /*
+    * domain shared by all users, which do not bring their own
+    */
+    static Domain& global() {
+        static Domain domain;
+        return domain;
+    }
+
+    /*
+    * hands the object over to the domain, reclaim( context, value )
+    * is called once no thread can reach it
+    */
+    void retire( Guard& guard, uintptr_t value, void *context, reclaimer reclaim ) {
+        Record& record = *guard._record;
+        if ( ++record._retires % _threshold == 0 )
+            advance();
+
+        size_t epoch = _epoch.load();
+        record.lock();
+        while ( !room( record, epoch )) {
+            //no memory to grow the list, the next epoch empties another one
+            record.unlock();
+            advance();
+            epoch = _epoch.load();
+            record.lock();
+        }
+        record._limbo[ epoch % 3 ].retired.push_back( { value, context, reclaim } );
+        record.unlock();
+    }
+
+    /*
+    * tries to advance the epoch and reclaims everything safe in lists
+    * of all threads, e.g. when the memory is exhausted.
+    * Returns the number of reclaimed objects.
+    */
+    size_t collect() {
+        advance();
+        size_t epoch = _epoch.load();
+        size_t reclaimed = 0;
+        used( [&]( Record& record ) {
+            record.lock();
+            for ( auto& limbo : record._limbo ) {
+                if ( limbo.epoch + 2 <= epoch ) {
+                    reclaimed += limbo.retired.size();
+                    release( limbo.retired );
+                }
+            }
+            record.unlock();
+        } );
+        return reclaimed;
+    }
+
+    /*
+    * reclaims all objects retired with given context regardless of epoch.
+    * Used when the owner of the objects is destroyed, so nobody can reach them.
+    */
+    void drain( void *context ) {
+        used( [context]( Record& record ) {
+            record.lock();
+            for ( auto& limbo : record._limbo ) {
+                size_t kept = 0;
+                for ( auto& retired : limbo.retired ) {
+                    if ( retired.context == context )
+                        retired.reclaim( retired.context, retired.value );
+                    else
+                        limbo.retired[ kept++ ] = retired;
+                }
+                limbo.retired.resize( kept );
+            }
+            record.unlock();
+        } );
+    }
+
+    size_t epoch() const {
+        return _epoch.load( std::memory_order_relaxed );
+    }
+
+    /*
+    * expects no thread uses the domain anymore, reclaims everything
+    */
+    ~Domain() {
+        for ( auto& record : _records ) {
+            for ( auto& limbo : record._limbo ) {
+                release( limbo.retired );
+            }
+        }
+    }
+
+private:
+    size_t _threshold;
+    std::atomic< size_t > _epoch;
+    // number of records that have ever been used
+    std::atomic< size_t > _active;
+    std::array< Record, maxThreads + 1 > _records;
+
+    // calls fn on every record, which has ever been used
+    template< typename Fn >
+    void used( Fn fn ) {
+        size_t active = _active.load();
+        for ( size_t i = 0; i < active && i < maxThreads; ++i ) {
+            fn( _records[ i ] );
+        }
+        fn( _records[ maxThreads ] );
+    }
+
+    void activate( size_t index ) {
+        size_t active = _active.load( std::memory_order_relaxed );
+        while ( active <= index && !_active.compare_exchange_weak( active, index + 1 )) { }
+    }
+
+    /*
+    * advances the global epoch, if every thread in critical section
+    * has announced the current one
+    */
+    void advance() {
+        size_t epoch = _epoch.load();
+        bool announced = true;
+        used( [epoch, &announced]( Record& record ) {
+            size_t state = record._state.load();
+            announced = announced && ( !( state & 1 ) || ( state >> 1 ) == epoch );
+        } );
+        if ( announced )
+            _epoch.compare_exchange_strong( epoch, epoch + 1 );
+    }
+
+    // reserves the limbo lists, before the record is used for the first time
+    void prepare( Record& record ) {
+        record.lock();
+        try {
+            for ( auto& limbo : record._limbo ) {
+                limbo.retired.reserve( _threshold );
+            }
+        } catch ( ... ) {
+            record.unlock();
+            throw;
+        }
+        record._prepared = true;
+        record.unlock();
+    }
+
+    /*
+    * expects locked record, makes the limbo list of epoch ready for one
+    * more object (without allocation in push_back); false if it is full
+    * and cannot grow
+    */
+    bool room( Record& record, size_t epoch ) {
+        Limbo& limbo = record._limbo[ epoch % 3 ];
+        if ( limbo.epoch != epoch ) {
+            //the list holds objects at least three epochs old
+            release( limbo.retired );
+            limbo.epoch = epoch;
+        }
+        auto& retired = limbo.retired;
+        if ( retired.size() < retired.capacity())
+            return true;
+        try {
+            retired.reserve( 2 * retired.capacity() + 1 );
+        } catch ( const std::bad_alloc& ) {
+            return false;
+        }
+        return true;
+    }
+
+    static void release( std::vector< Retired >& retired ) {
+        for ( auto& item : retired ) {
+            item.reclaim( item.context, item.value );
+        }
+        retired.clear();
+    }
+};
+
+} //namespace epoch
+} //namespace lockfree
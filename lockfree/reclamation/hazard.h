@@ -0,0 +1,251 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+
+#include "../thread_index.h"
+
+namespace lockfree {
+namespace hazard {
+
+/*
+* Hazard pointer domain
+* Every thread owns a record with Slots hazard pointers. A thread publishes
+* the address it is going to dereference in one of its slots (and checks,
+* that the address is still reachable), and no other thread may reclaim
+* the memory while the address is published.
+* Removed objects are retired to the list of the retiring thread and they
+* are reclaimed in batches: once the list holds threshold objects, it is
+* scanned against all published hazard pointers.
+*
+* Records are indexed by lockfree::threadIndex(). Threads above maxThreads
+* share one more record, which they hold exclusively for the whole guard.
+*
+* The first guard of a record reserves its retired list and the buffer
+* for scans, so retire never allocates (nor throws) after the caller
+* has unlinked the object: a scan keeps at most all published hazards.
+*/
+template< size_t Slots = 2 >
+class Domain {
+public:
+    // called with the context and value given to retire
+    using reclaimer = void (*)( void *context, uintptr_t value );
+
+private:
+    struct Retired {
+        const void *address;
+        uintptr_t value;
+        void *context;
+        reclaimer reclaim;
+    };
+
+    // the most hazard pointers published at once
+    static constexpr size_t hazardCount = ( maxThreads + 1 ) * Slots;
+
+    /*
+    * _busy guards the retired list - taken by the owner on every retire,
+    * contended only if other thread reclaims everything
+    */
+    struct alignas( 64 ) Record {
+        std::array< std::atomic< const void * >, Slots > _hazards{ };
+        std::atomic< bool > _busy{ false };
+        std::atomic< bool > _owned{ false };
+        // set (and read) only by the thread holding the record
+        bool _prepared = false;
+        std::vector< Retired > _retired;
+        // published hazards gathered by scan of this record
+        std::vector< const void * > _gathered;
+
+        void lock() {
+            while ( _busy.exchange( true, std::memory_order_acquire )) { }
+        }
+
+        void unlock() {
+            _busy.store( false, std::memory_order_release );
+        }
+    };
+
+public:
+
+    /*
+    * Protection of one operation of the calling thread.
+    * Published hazard pointers are cleared in destructor.
+    */
+    class Guard {
+    public:
+        explicit Guard( Domain& domain ) : _domain( domain ), _index( threadIndex()) {
+            if ( _index >= maxThreads ) {
+                _index = maxThreads;
+                while ( _domain._records[ _index ]._owned.exchange( true, std::memory_order_acquire )) { }
+            }
+            _record = &_domain._records[ _index ];
+            _domain.activate( _index );
+            if ( !_record->_prepared )
+                _domain.prepare( *_record );
+        }
+
+        Guard( const Guard& ) = delete;
+        Guard& operator=( const Guard& ) = delete;
+
+        /*
+        * publishes the address, the caller has to check afterwards,
+        * that the object is still reachable
+        */
+        void protect( size_t slot, const void *address ) {
+            assert( slot < Slots );
+            _record->_hazards[ slot ].store( address );
+        }
+
+        void clear( size_t slot ) {
+            _record->_hazards[ slot ].store( nullptr, std::memory_order_release );
+        }
+
+        ~Guard() {
+            for ( size_t i = 0; i < Slots; ++i ) {
+                clear( i );
+            }
+            if ( _index == maxThreads )
+                _record->_owned.store( false, std::memory_order_release );
+        }
+
+    private:
+        friend Domain;
+        Domain& _domain;
+        size_t _index;
+        Record *_record;
+    };
+
+    explicit Domain( size_t threshold = 64 ) : _threshold( threshold ), _active( 0 ), _scans( 0 ) {
+    }
+
+    Domain( const Domain& ) = delete;
+    Domain& operator=( const Domain& ) = delete;
+
+    /*
+    * hands the object over to the domain, reclaim( context, value )
+    * is called once no thread has address published
+    */
+    void retire( Guard& guard, const void *address, uintptr_t value, void *context, reclaimer reclaim ) {
+        Record& record = *guard._record;
+        record.lock();
+        assert( record._retired.size() < record._retired.capacity());
+        record._retired.push_back( { address, value, context, reclaim } );
+        if ( record._retired.size() >= _threshold )
+            scan( record );
+        record.unlock();
+    }
+
+    /*
+    * scans retired lists of all threads, e.g. when the memory is exhausted.
+    * Returns the number of reclaimed objects.
+    */
+    size_t collect() {
+        size_t reclaimed = 0;
+        used( [&]( Record& record ) {
+            record.lock();
+            reclaimed += scan( record );
+            record.unlock();
+        } );
+        return reclaimed;
+    }
+
+    // number of objects waiting for reclamation (inexact during concurrent use)
+    size_t retired() {
+        size_t count = 0;
+        for ( auto& record : _records ) {
+            record.lock();
+            count += record._retired.size();
+            record.unlock();
+        }
+        return count;
+    }
+
+    size_t scans() const {
+        return _scans.load( std::memory_order_relaxed );
+    }
+
+    /*
+    * expects no thread uses the domain anymore, reclaims everything
+    */
+    ~Domain() {
+        for ( auto& record : _records ) {
+            for ( auto& retired : record._retired ) {
+                retired.reclaim( retired.context, retired.value );
+            }
+        }
+    }
+
+private:
+    size_t _threshold;
+    // number of records that have ever been used
+    std::atomic< size_t > _active;
+    std::atomic< size_t > _scans;
+    std::array< Record, maxThreads + 1 > _records;
+
+    // calls fn on every record, which has ever been used
+    template< typename Fn >
+    void used( Fn fn ) {
+        size_t active = _active.load();
+        for ( size_t i = 0; i < active && i < maxThreads; ++i ) {
+            fn( _records[ i ] );
+        }
+        fn( _records[ maxThreads ] );
+    }
+
+    void activate( size_t index ) {
+        size_t active = _active.load( std::memory_order_relaxed );
+        while ( active <= index && !_active.compare_exchange_weak( active, index + 1 )) { }
+    }
+
+    /*
+    * reserves the retired list for threshold objects and those kept
+    * by a scan, and the buffer of the scan
+    */
+    void prepare( Record& record ) {
+        record.lock();
+        try {
+            record._retired.reserve( std::max< size_t >( _threshold, 1 ) + hazardCount );
+            record._gathered.reserve( hazardCount );
+        } catch ( ... ) {
+            record.unlock();
+            throw;
+        }
+        record._prepared = true;
+        record.unlock();
+    }
+
+    // expects locked record, returns the number of reclaimed objects
+    size_t scan( Record& record ) {
+        _scans.fetch_add( 1, std::memory_order_relaxed );
+        if ( record._retired.empty())
+            return 0;
+        auto& hazards = record._gathered;
+        hazards.clear();
+        auto gather = [&hazards]( Record& other ) {
+            for ( auto& hazard : other._hazards ) {
+                if ( const void *address = hazard.load())
+                    hazards.push_back( address );
+            }
+        };
+        used( gather );
+        std::sort( hazards.begin(), hazards.end());
+
+        size_t kept = 0;
+        auto& retired = record._retired;
+        for ( size_t i = 0; i < retired.size(); ++i ) {
+            if ( std::binary_search( hazards.begin(), hazards.end(), retired[ i ].address ))
+                retired[ kept++ ] = retired[ i ];
+            else
+                retired[ i ].reclaim( retired[ i ].context, retired[ i ].value );
+        }
+        size_t reclaimed = retired.size() - kept;
+        retired.resize( kept );
+        return reclaimed;
+    }
+};
+
+} //namespace hazard
+} //namespace lockfree
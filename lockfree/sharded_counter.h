@@ -0,0 +1,75 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "thread_index.h"
+
+namespace lockfree {
+
+/*
+* Counter split into Shards cells, each on its own cache line.
+* A thread updates only the cell of its lockfree::threadIndex, so with
+* at most Shards threads the updates are uncontended and no cache line
+* bounces between cores. Cells may go negative (a thread may decrement
+* what other has incremented), only their sum is meaningful.
+*
+* With Batch 0, load() sums all cells - exact when no update is running
+* concurrently. With Batch > 0 every cell also moves a shared total
+* whenever it crosses a multiple of Batch, so load() reads just the total,
+* which differs from the exact sum by less than Shards * Batch.
+*/
+template< size_t Shards = 64, size_t Batch = 0 >
+class ShardedCounter {
+public:
+    static_assert( Shards > 0, "ShardedCounter needs at least one shard" );
+
+    ShardedCounter() = default;
+    ShardedCounter( const ShardedCounter& ) = delete;
+    ShardedCounter& operator=( const ShardedCounter& ) = delete;
+
+    void add( ptrdiff_t delta ) {
+        auto& cell = _cells[ threadIndex() % Shards ].value;
+        ptrdiff_t previous = cell.fetch_add( delta, std::memory_order_relaxed );
+        if constexpr ( Batch > 0 ) {
+            ptrdiff_t steps = floor( previous + delta ) - floor( previous );
+            if ( steps )
+                _total.fetch_add( steps * ptrdiff_t( Batch ), std::memory_order_relaxed );
+        }
+    }
+
+    size_t load() const {
+        if constexpr ( Batch > 0 ) {
+            ptrdiff_t total = _total.load( std::memory_order_relaxed );
+            return total > 0 ? size_t( total ) : 0;
+        } else {
+            return exact();
+        }
+    }
+
+    // sum of all cells
+    size_t exact() const {
+        ptrdiff_t sum = 0;
+        for ( auto& cell : _cells ) {
+            sum += cell.value.load( std::memory_order_relaxed );
+        }
+        return sum > 0 ? size_t( sum ) : 0;
+    }
+
+private:
+    struct alignas( 64 ) Cell {
+        std::atomic< ptrdiff_t > value{ 0 };
+    };
+
+    std::array< Cell, Shards > _cells;
+    alignas( 64 ) std::atomic< ptrdiff_t > _total{ 0 };
+
+    // index of the batch value belongs to, rounded down also for negative values
+    static ptrdiff_t floor( ptrdiff_t value ) {
+        ptrdiff_t batch = ptrdiff_t( Batch );
+        return value >= 0 ? value / batch : -(( -value + batch - 1 ) / batch );
+    }
+};
+
+} //namespace lockfree
@@ -23,7 +23,7 @@ void producerFn() {
 void consumerFn() {
     for (int i = 0; i < ITER; ++i){
         int value;
-        while (!queue.pop(value)) {}
+        queue.pop_wait(value);
         ++consumerCount;
     }
 }
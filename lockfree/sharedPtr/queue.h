@@ -1,30 +1,71 @@
 #pragma once
 #include <memory>
 #include <atomic>
+#include <iterator>
+#include <new>
 #include <cassert>
 #include <iostream>
 
+#include "../reclamation/epoch.h"
+#include "../event_count.h"
+
 namespace lockfree {
 namespace sharedPtr {
 
+// nodes are held by shared pointers
+struct Counted {};
+// nodes are plain pointers, retired to an epoch domain
+struct Epochs {};
+
 /*
 * parallel queue. Its lock-freeness depends
 * on platform
 * nodes holds as share pointers to prevent problem
 * with memory leaks
 */
-template< typename T >
+template< typename T, typename Reclamation = Counted >
 struct Queue {
 
+    /*
+    * the value lives in uninitialized storage: the sentinel holds none,
+    * pop destroys the value once it is moved out
+    */
     struct node {
-        node( T value ) : _value( value ), _next( nullptr ) {
+        node() : _next( nullptr ) {
+        }
+
+        explicit node( T value ) : _next( nullptr ) {
+            new( _storage ) T( std::move( value ));
+        }
+
+        node( const node& ) = delete;
+        node& operator=( const node& ) = delete;
+
+        /*
+        * a thread preempted while holding an old node keeps the whole chain
+        * behind it alive, so the chain is released in a loop - recursive
+        * destruction of the next nodes would overflow the stack
+        */
+        ~node() {
+            auto next = std::move( _next );
+            while ( next && next.use_count() == 1 ) {
+                auto after = std::move( next->_next );
+                next = std::move( after );
+            }
+        }
+
+        T& value() {
+            return *std::launder( reinterpret_cast< T * >( _storage ));
         }
 
-        T _value;
+        alignas( T ) unsigned char _storage[ sizeof( T ) ];
         std::shared_ptr< node > _next;
     };
 
-    Queue() : head( new node( T())), tail( head ) {
+    // tries of pop_wait before it sleeps
+    static constexpr size_t spin = 64;
+
+    Queue() : head( std::make_shared< node >()), tail( head ) {
         std::cerr << "This queue is ";
         if ( !atomic_is_lock_free( &head ))
             std::cerr << "not ";
@@ -38,13 +79,17 @@ struct Queue {
             auto last = atomic_load( &tail );
             auto next = atomic_load( &last->_next );
 
-            if ( last == tail ) {
+            if ( last == atomic_load( &tail )) {
                 if ( next == nullptr ) {
                     //try to add me as last
                     if ( atomic_compare_exchange_weak( &last->_next, &next, toInsert )) {
                         //I was successful, so I try to be the new tail
                         atomic_compare_exchange_weak( &tail, &last, toInsert );
                         //if i hasn't been successful it means, that some other node becomes tail
+                        //the atomic shared_ptr functions may take a lock, so a fence
+                        //orders the push before the check of waiters (see EventCount)
+                        std::atomic_thread_fence( std::memory_order_seq_cst );
+                        _pushed.notify_one();
                         return true;
                     }
                 } else {
@@ -55,13 +100,56 @@ struct Queue {
         }
     }
 
+    /*
+    * inserts the items of [from, to) in their order, the nodes are
+    * chained privately and linked to the queue by one CAS on _next
+    * and one on tail; returns the number of items inserted
+    */
+    template< typename InputIt >
+    size_t push_bulk( InputIt from, InputIt to ) {
+        if ( from == to )
+            return 0;
+        auto chain = std::make_shared< node >( *from );
+        auto end = chain;
+        size_t count = 1;
+        for ( ++from; from != to; ++from, ++count ) {
+            end->_next = std::make_shared< node >( *from );
+            end = end->_next;
+        }
+
+        while ( true ) {
+            auto last = atomic_load( &tail );
+            auto next = atomic_load( &last->_next );
+
+            if ( last == atomic_load( &tail )) {
+                if ( next == nullptr ) {
+                    if ( atomic_compare_exchange_weak( &last->_next, &next, chain )) {
+                        atomic_compare_exchange_weak( &tail, &last, end );
+                        std::atomic_thread_fence( std::memory_order_seq_cst );
+                        _pushed.notify_all();
+                        return count;
+                    }
+                } else {
+                    atomic_compare_exchange_weak( &tail, &last, next );
+                }
+            }
+        }
+    }
+
+    template< typename Range >
+    size_t push_bulk( Range&& range ) {
+        using std::begin;
+        using std::end;
+        return push_bulk( begin( range ), end( range ));
+    }
+
     bool pop( T& out ) {
         while ( true ) {
             auto sentinel = atomic_load( &head );
-            auto last = atomic_load( &tail );;
+            auto last = atomic_load( &tail );
             auto first = atomic_load( &sentinel->_next );
 
-            if ( sentinel == head ) {
+            if ( sentinel == atomic_load( &head )) {
                 if ( sentinel == last ) {
                     if ( first == nullptr ) {
                         return false;
@@ -70,7 +158,8 @@ struct Queue {
                     atomic_compare_exchange_weak( &tail, &last, first );
                 } else {
                     if ( atomic_compare_exchange_weak( &head, &sentinel, first )) {
-                        out = first->_value;
+                        out = std::move( first->value());
+                        first->value().~T();
                         return true;
                     }
                 }
@@ -78,8 +167,298 @@ struct Queue {
         }
     }
 
+    /*
+    * pops an item, if the queue is empty, tries pop spin times and then
+    * sleeps until a push; pushes notify only while some consumer waits
+    */
+    void pop_wait( T& out ) {
+        for ( size_t i = 0; i < spin; ++i ) {
+            if ( pop( out ))
+                return;
+        }
+        while ( true ) {
+            auto key = _pushed.prepare();
+            if ( pop( out )) {
+                _pushed.cancel();
+                return;
+            }
+            _pushed.wait( key );
+        }
+    }
+
+    // number of consumers sleeping in pop_wait (or about to)
+    size_t waiting() const {
+        return _pushed.waiting();
+    }
+
+    /*
+    * pops up to max items in their order to out by one CAS of head,
+    * which moves over all of them (never beyond the tail seen);
+    * returns their number
+    */
+    template< typename OutputIt >
+    size_t pop_bulk( OutputIt out, size_t max ) {
+        while ( max ) {
+            auto sentinel = atomic_load( &head );
+            auto last = atomic_load( &tail );
+            auto first = atomic_load( &sentinel->_next );
+
+            if ( sentinel == atomic_load( &head )) {
+                if ( sentinel == last ) {
+                    if ( first == nullptr ) {
+                        return 0;
+                    }
+                    //help other thread to advance the tail of queue
+                    atomic_compare_exchange_weak( &tail, &last, first );
+                } else {
+                    auto end = first;
+                    size_t count = 1;
+                    for ( ; count < max && end != last; ++count ) {
+                        auto next = atomic_load( &end->_next );
+                        if ( next == nullptr )
+                            break;
+                        end = std::move( next );
+                    }
+                    if ( atomic_compare_exchange_weak( &head, &sentinel, end )) {
+                        for ( auto current = first;; current = current->_next ) {
+                            *out++ = std::move( current->value());
+                            current->value().~T();
+                            if ( current == end )
+                                return count;
+                        }
+                    }
+                }
+            }
+        }
+        return 0;
+    }
+
+    /*
+    * expects that no thread access the queue during and after destructor;
+    * values left after the sentinel are destroyed, the nodes are freed
+    * with their last shared pointer
+    */
+    ~Queue() {
+        for ( auto current = head->_next; current; current = current->_next )
+            current->value().~T();
+    }
+
 private:
     std::shared_ptr< node > head, tail;
+    // consumers sleeping in pop_wait
+    alignas( 64 ) EventCount _pushed;
+};
+
+/*
+* non-refcounted variant: nodes are raw pointers, so push and pop do not
+* touch any reference counters. Popped sentinels are retired
+* to an epoch domain, which may be shared with other queues.
+*/
+template< typename T >
+struct Queue< T, Epochs > {
+
+    // the value is kept as in the Counted variant
+    struct node {
+        node() : _next( nullptr ) {
+        }
+
+        explicit node( T value ) : _next( nullptr ) {
+            new( _storage ) T( std::move( value ));
+        }
+
+        T& value() {
+            return *std::launder( reinterpret_cast< T * >( _storage ));
+        }
+
+        alignas( T ) unsigned char _storage[ sizeof( T ) ];
+        std::atomic< node * > _next;
+    };
+
+    static constexpr size_t spin = 64;
+
+    Queue() : Queue( epoch::Domain::global()) {
+    }
+
+    explicit Queue( epoch::Domain& domain ) : head( new node()), tail( head.load()), _domain( domain ) {
+    }
+
+    bool push( T value ) {
+        auto toInsert = new node( std::move( value ));
+        epoch::Domain::Guard guard( _domain );
+
+        while ( true ) {
+            auto last = tail.load();
+            auto next = last->_next.load();
+
+            if ( last == tail ) {
+                if ( next == nullptr ) {
+                    //try to add me as last
+                    if ( last->_next.compare_exchange_weak( next, toInsert )) {
+                        //I was successful, so I try to be the new tail
+                        tail.compare_exchange_weak( last, toInsert );
+                        //if i hasn't been successful it means, that some other node becomes tail
+                        _pushed.notify_one();
+                        return true;
+                    }
+                } else {
+                    //help other node to become a tail
+                    tail.compare_exchange_weak( last, next );
+                }
+            }
+        }
+    }
+
+    // as push_bulk of the Counted variant
+    template< typename InputIt >
+    size_t push_bulk( InputIt from, InputIt to ) {
+        if ( from == to )
+            return 0;
+        auto chain = new node( *from );
+        auto end = chain;
+        size_t count = 1;
+        for ( ++from; from != to; ++from, ++count ) {
+            auto toInsert = new node( *from );
+            end->_next.store( toInsert, std::memory_order_relaxed );
+            end = toInsert;
+        }
+        epoch::Domain::Guard guard( _domain );
+
+        while ( true ) {
+            auto last = tail.load();
+            auto next = last->_next.load();
+
+            if ( last == tail ) {
+                if ( next == nullptr ) {
+                    if ( last->_next.compare_exchange_weak( next, chain )) {
+                        tail.compare_exchange_weak( last, end );
+                        _pushed.notify_all();
+                        return count;
+                    }
+                } else {
+                    tail.compare_exchange_weak( last, next );
+                }
+            }
+        }
+    }
+
+    template< typename Range >
+    size_t push_bulk( Range&& range ) {
+        using std::begin;
+        using std::end;
+        return push_bulk( begin( range ), end( range ));
+    }
+
+    bool pop( T& out ) {
+        epoch::Domain::Guard guard( _domain );
+        while ( true ) {
+            auto sentinel = head.load();
+            auto last = tail.load();
+            auto first = sentinel->_next.load();
+
+            if ( sentinel == head ) {
+                if ( sentinel == last ) {
+                    if ( first == nullptr ) {
+                        return false;
+                    }
+                    //help other thread to advance the tail of queue
+                    tail.compare_exchange_weak( last, first );
+                } else {
+                    if ( head.compare_exchange_weak( sentinel, first )) {
+                        out = std::move( first->value());
+                        first->value().~T();
+                        _domain.retire( guard, reinterpret_cast< uintptr_t >( sentinel ), this, &Queue::reclaim );
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+    // as pop_wait of the Counted variant
+    void pop_wait( T& out ) {
+        for ( size_t i = 0; i < spin; ++i ) {
+            if ( pop( out ))
+                return;
+        }
+        while ( true ) {
+            auto key = _pushed.prepare();
+            if ( pop( out )) {
+                _pushed.cancel();
+                return;
+            }
+            _pushed.wait( key );
+        }
+    }
+
+    // number of consumers sleeping in pop_wait (or about to)
+    size_t waiting() const {
+        return _pushed.waiting();
+    }
+
+    // as pop_bulk of the Counted variant, the former sentinels are retired
+    template< typename OutputIt >
+    size_t pop_bulk( OutputIt out, size_t max ) {
+        epoch::Domain::Guard guard( _domain );
+        while ( max ) {
+            auto sentinel = head.load();
+            auto last = tail.load();
+            auto first = sentinel->_next.load();
+
+            if ( sentinel == head ) {
+                if ( sentinel == last ) {
+                    if ( first == nullptr ) {
+                        return 0;
+                    }
+                    //help other thread to advance the tail of queue
+                    tail.compare_exchange_weak( last, first );
+                } else {
+                    auto end = first;
+                    size_t count = 1;
+                    for ( ; count < max && end != last; ++count ) {
+                        auto next = end->_next.load();
+                        if ( next == nullptr )
+                            break;
+                        end = next;
+                    }
+                    if ( head.compare_exchange_weak( sentinel, end )) {
+                        for ( auto current = sentinel; current != end; ) {
+                            auto next = current->_next.load( std::memory_order_relaxed );
+                            *out++ = std::move( next->value());
+                            next->value().~T();
+                            _domain.retire( guard, reinterpret_cast< uintptr_t >( current ), this, &Queue::reclaim );
+                            current = next;
+                        }
+                        return count;
+                    }
+                }
+            }
+        }
+        return 0;
+    }
+
+    /*
+    * expects that no thread access the queue during and after destructor
+    */
+    ~Queue() {
+        _domain.drain( this );
+        auto current = head.load();
+        for ( bool sentinel = true; current; sentinel = false ) {
+            auto next = current->_next.load();
+            if ( !sentinel )
+                current->value().~T();
+            delete current;
+            current = next;
+        }
+    }
+
+private:
+    std::atomic< node * > head, tail;
+    epoch::Domain& _domain;
+    alignas( 64 ) EventCount _pushed;
+
+    static void reclaim( void *, uintptr_t value ) {
+        delete reinterpret_cast< node * >( value );
+    }
 };
 
 } //namespace sharedPtr
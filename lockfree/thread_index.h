@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+namespace lockfree {
+
+// the number of threads that can hold an index at the same time
+static constexpr size_t maxThreads = 256;
+
+namespace detail {
+
+/*
+* Registration of a thread in the table of indices.
+* The index is taken on the first use in the thread and returned
+* when the thread exits, so it can be reused by a new thread.
+* Threads above maxThreads obtain maxThreads.
+*/
+struct ThreadSlot {
+    ThreadSlot() : index( maxThreads ) {
+        for ( size_t i = 0; i < maxThreads; ++i ) {
+            if ( !table()[ i ].load( std::memory_order_relaxed ) && !table()[ i ].exchange( true )) {
+                index = i;
+                break;
+            }
+        }
+    }
+
+    ~ThreadSlot() {
+        if ( index < maxThreads )
+            table()[ index ].store( false );
+    }
+
+    static std::atomic< bool > *table() {
+        static std::atomic< bool > used[maxThreads];
+        return used;
+    }
+
+    size_t index;
+};
+
+} //namespace detail
+
+/*
+* returns small index of the calling thread, unique among living threads
+*/
+inline size_t threadIndex() {
+    thread_local detail::ThreadSlot slot;
+    return slot.index;
+}
+
+} //namespace lockfree
@@ -1,22 +1,29 @@
 #define CATCH_CONFIG_MAIN
 #include <thread>
 #include <set>
-#define HOLDSIZE 1
+#include <list>
+#include <map>
+#include <algorithm>
+#include <iterator>
 #include "../lockfree/memPool/queue.h"
+#include "../lockfree/memPool/fixed_pool.h"
+#include "../lockfree/sharedPtr/queue.h"
 #include "catch.hpp"
 
+namespace policy = lockfree::memPool::policy;
+
 
 
 
 TEST_CASE("valid after construct") {
-	lockfree::memPool::Queue<int, 512> queue;
+	lockfree::memPool::Queue<int, 512, policy::SizeTracking> queue;
 	REQUIRE(queue.empty());
 	REQUIRE(queue.used() == 1); //for sentinel
 	REQUIRE(queue.available() == 511);
 }
 
 TEST_CASE("push and pop") {
-	lockfree::memPool::Queue<int, 512> queue;
+	lockfree::memPool::Queue<int, 512, policy::SizeTracking> queue;
 	queue.push(5);
 	REQUIRE(!queue.empty());
 	REQUIRE(queue.used() == 2); //for sentinel
@@ -31,7 +38,7 @@ TEST_CASE("push and pop") {
 	REQUIRE(queue.available() == 511);
 }
 
-void producerFn(lockfree::memPool::Queue<size_t,512> *queue, size_t from, size_t to) {
+void producerFn(lockfree::memPool::Queue<size_t, 512, policy::SizeTracking> *queue, size_t from, size_t to) {
     for (size_t i = from; i < to; ++i) {
         while(!queue->push(i)) {};
     }
@@ -40,7 +47,7 @@ void producerFn(lockfree::memPool::Queue<size_t,512> *queue, size_t from, size_t
 
 TEST_CASE("no element lost in push") {
   const size_t repeat =  400;
-	lockfree::memPool::Queue<size_t, 512> queue;
+	lockfree::memPool::Queue<size_t, 512, policy::SizeTracking> queue;
     std::thread producers[3];
     producers[0]= std::thread(producerFn, &queue, 0, repeat/4);
     producers[1]= std::thread(producerFn, &queue, repeat/4, repeat/2);
@@ -72,7 +79,7 @@ TEST_CASE("no element lost in push") {
 }
 
 
-void consumerFn(lockfree::memPool::Queue<size_t,512> *queue,
+void consumerFn(lockfree::memPool::Queue<size_t, 512, policy::SizeTracking> *queue,
                           std::set<size_t> *results) {
     	size_t value;
       while(queue->pop(value)) {
@@ -83,7 +90,7 @@ void consumerFn(lockfree::memPool::Queue<size_t,512> *queue,
 
 TEST_CASE("no element lost in pop") {
   const size_t repeat =  400;
-	lockfree::memPool::Queue<size_t, 512> queue;
+	lockfree::memPool::Queue<size_t, 512, policy::SizeTracking> queue;
 	for (size_t i = 0; i < repeat; ++i) {
 		queue.push(i);
 	}
@@ -119,3 +126,1151 @@ TEST_CASE("no element lost in pop") {
 	REQUIRE(content.empty());
 }
 
+
+TEST_CASE("bitmap hands out every bit exactly once") {
+	const size_t size = 64 * 64 * 2 + 64;
+	lockfree::memPool::Bitmap bitmap(size);
+	std::set<size_t> taken;
+	for (size_t i = 0; i < size; ++i) {
+		size_t index = bitmap.acquire(i * 7);
+		REQUIRE(index < size);
+		taken.insert(index);
+	}
+	REQUIRE(taken.size() == size);
+	REQUIRE(bitmap.acquire(0) == lockfree::memPool::Bitmap::npos);
+
+	bitmap.release(4097);
+	bitmap.release(3);
+	REQUIRE(bitmap.acquire(0) == 3);
+	REQUIRE(bitmap.acquire(0) == 4097);
+	REQUIRE(bitmap.acquire(0) == lockfree::memPool::Bitmap::npos);
+}
+
+TEST_CASE("slots parked in magazines are not lost") {
+	using Queue = lockfree::memPool::Queue<size_t, 512, policy::Magazines<16>, policy::SizeTracking>;
+	Queue queue;
+
+	//leaves free slots in the magazine of already finished thread
+	std::thread worker([&queue] {
+		for (size_t i = 0; i < 40; ++i) {
+			queue.push(i);
+		}
+		size_t value;
+		while (queue.pop(value)) {}
+	});
+	worker.join();
+	REQUIRE(queue.parked() > 2);
+	REQUIRE(queue.used() == 1); //for sentinel
+
+	size_t pushed = 0;
+	while (queue.push(pushed)) {
+		++pushed;
+	}
+	REQUIRE(pushed == 509); //the pool keeps two slots in reserve
+	REQUIRE(queue.parked() <= 2);
+
+	size_t value;
+	for (size_t i = 0; i < pushed; ++i) {
+		REQUIRE(queue.pop(value));
+		REQUIRE(value == i);
+	}
+	REQUIRE(queue.empty());
+	REQUIRE(queue.available() == 511);
+}
+
+TEST_CASE("pool grows up to its limit") {
+	using Queue = lockfree::memPool::Queue<size_t, 128, policy::Growth<1024>, policy::SizeTracking>;
+	Queue queue;
+	REQUIRE(queue.capacity() == 128);
+
+	size_t pushed = 0;
+	while (queue.push(pushed)) {
+		++pushed;
+	}
+	REQUIRE(pushed == 1021); //the pool keeps two slots in reserve
+	REQUIRE(queue.capacity() == 1024);
+	REQUIRE(queue.available() == 2);
+
+	size_t value;
+	for (size_t i = 0; i < pushed; ++i) {
+		REQUIRE(queue.pop(value));
+		REQUIRE(value == i);
+	}
+	REQUIRE(queue.empty());
+	REQUIRE(queue.used() == 1);
+}
+
+void growingProducerFn(lockfree::memPool::Queue<size_t, 64, policy::Growth<4096>, policy::SizeTracking> *queue,
+                       size_t from, size_t to) {
+	for (size_t i = from; i < to; ++i) {
+		if (!queue->push(i))
+			return;
+	}
+}
+
+TEST_CASE("pool grows under parallel push") {
+	const size_t repeat = 3000;
+	lockfree::memPool::Queue<size_t, 64, policy::Growth<4096>, policy::SizeTracking> queue;
+	std::thread producers[3];
+	for (size_t i = 0; i < 3; ++i) {
+		producers[i] = std::thread(growingProducerFn, &queue, i * repeat / 3, (i + 1) * repeat / 3);
+	}
+	for (int i = 0; i < 3; ++i) {
+		producers[i].join();
+	}
+	REQUIRE(queue.capacity() == 4096);
+
+	std::set<size_t> content;
+	size_t current;
+	while (queue.pop(current)) {
+		content.insert(current);
+	}
+	REQUIRE(content.size() == repeat);
+	REQUIRE(queue.used() == 1);
+}
+
+template <typename Queue>
+void churnFn(Queue *queue, size_t from, size_t to, std::atomic<size_t> *sum) {
+	for (size_t i = from; i < to; ++i) {
+		while (!queue->push(i)) {}
+		size_t value;
+		while (!queue->pop(value)) {}
+		*sum += value;
+	}
+}
+
+TEST_CASE("handles survive heavy slot reuse") {
+	using Queue = lockfree::memPool::Queue<size_t, 64, policy::Handles, policy::SizeTracking>;
+	const size_t repeat = 20000;
+	Queue queue;
+	std::atomic<size_t> sum(0);
+	std::thread workers[4];
+	for (size_t i = 0; i < 4; ++i) {
+		workers[i] = std::thread(churnFn<Queue>, &queue, i * repeat / 4, (i + 1) * repeat / 4, &sum);
+	}
+	for (int i = 0; i < 4; ++i) {
+		workers[i].join();
+	}
+	REQUIRE(sum == repeat * (repeat - 1) / 2);
+	REQUIRE(queue.empty());
+	REQUIRE(queue.used() == 1);
+}
+
+TEST_CASE("hazard pointers return retired nodes to the pool") {
+	//the threshold is bigger than the pool, so retired nodes fill it up
+	using Queue = lockfree::memPool::Queue<size_t, 128, policy::HazardPointers<1000>>;
+	Queue queue;
+	size_t value;
+	for (size_t i = 0; i < 1000; ++i) {
+		REQUIRE(queue.push(i));
+		REQUIRE(queue.pop(value));
+		REQUIRE(value == i);
+	}
+	REQUIRE(queue.empty());
+}
+
+TEST_CASE("hazard pointers under slot reuse") {
+	using Queue = lockfree::memPool::Queue<size_t, 128, policy::HazardPointers<16>>;
+	const size_t repeat = 20000;
+	Queue queue;
+	std::atomic<size_t> sum(0);
+	std::thread workers[4];
+	for (size_t i = 0; i < 4; ++i) {
+		workers[i] = std::thread(churnFn<Queue>, &queue, i * repeat / 4, (i + 1) * repeat / 4, &sum);
+	}
+	for (int i = 0; i < 4; ++i) {
+		workers[i].join();
+	}
+	REQUIRE(sum == repeat * (repeat - 1) / 2);
+	REQUIRE(queue.empty());
+}
+
+TEST_CASE("queues share one epoch domain") {
+	using Queue = lockfree::memPool::Queue<size_t, 128, policy::Epochs>;
+	const size_t repeat = 20000;
+	lockfree::epoch::Domain domain(16);
+	Queue first(domain);
+	Queue second(domain);
+	std::atomic<size_t> sum(0);
+	std::thread workers[4];
+	for (size_t i = 0; i < 4; ++i) {
+		workers[i] = std::thread(churnFn<Queue>, i % 2 ? &first : &second,
+		                         i * repeat / 4, (i + 1) * repeat / 4, &sum);
+	}
+	for (int i = 0; i < 4; ++i) {
+		workers[i].join();
+	}
+	REQUIRE(sum == repeat * (repeat - 1) / 2);
+	REQUIRE(first.empty());
+	REQUIRE(second.empty());
+	REQUIRE(domain.epoch() > 0);
+
+	//threshold 0 advances on every retire
+	lockfree::epoch::Domain eager(0);
+	Queue third(eager);
+	size_t value;
+	for (size_t i = 0; i < 1000; ++i) {
+		REQUIRE(third.push(i));
+		REQUIRE(third.pop(value));
+		REQUIRE(value == i);
+	}
+	REQUIRE(eager.epoch() > 0);
+}
+
+TEST_CASE("large pool is initialized lazily or by prefault") {
+	using Queue = lockfree::memPool::Queue<size_t, 1 << 16, policy::Growth<1 << 17>, policy::SizeTracking>;
+	std::unique_ptr<Queue> lazy(new Queue());
+	std::unique_ptr<Queue> prefaulted(new Queue());
+	prefaulted->prefault(4);
+
+	for (Queue *queue : {lazy.get(), prefaulted.get()}) {
+		const size_t repeat = 100000; //spans many chunks and the second slab
+		for (size_t i = 0; i < repeat; ++i) {
+			REQUIRE(queue->push(i));
+		}
+		size_t value;
+		for (size_t i = 0; i < repeat; ++i) {
+			REQUIRE(queue->pop(value));
+			REQUIRE(value == i);
+		}
+		REQUIRE(queue->empty());
+		REQUIRE(queue->used() == 1);
+	}
+}
+
+TEST_CASE("small pool grows through many slabs") {
+	//chunk states are allocated per slab, not for the whole limit
+	using Queue = lockfree::memPool::Queue<size_t, 64, policy::Growth<1 << 24>>;
+	Queue::Pool pool(64, 1 << 24);
+	Queue queue(pool);
+	const size_t repeat = 20000; //slabs of 64 up to 8192 slots
+	for (size_t i = 0; i < repeat; ++i) {
+		REQUIRE(queue.push(i));
+	}
+	pool.prefault(3);
+	size_t value;
+	for (size_t i = 0; i < repeat; ++i) {
+		REQUIRE(queue.pop(value));
+		REQUIRE(value == i);
+	}
+	REQUIRE(queue.empty());
+}
+
+TEST_CASE("pool backed by huge pages") {
+	using namespace lockfree::memPool;
+	using Queue = Queue<size_t, 1 << 12, policy::HugePages<Pages::explicit_>, policy::Growth<1 << 14>>;
+	Queue queue;
+	const size_t repeat = 10000;
+	for (size_t i = 0; i < repeat; ++i) {
+		REQUIRE(queue.push(i));
+	}
+	REQUIRE(queue.capacity() == 1 << 14);
+	size_t value;
+	for (size_t i = 0; i < repeat; ++i) {
+		REQUIRE(queue.pop(value));
+		REQUIRE(value == i);
+	}
+	REQUIRE(queue.empty());
+}
+
+TEST_CASE("queues share one runtime sized pool") {
+	using Queue = lockfree::memPool::Queue<size_t, 2048, policy::SizeTracking>;
+	size_t size = 1000; //rounded up to 1024
+	Queue::Pool pool(size);
+	Queue first(pool);
+	Queue second(pool);
+	REQUIRE(&first.pool() == &second.pool());
+	REQUIRE(pool.used() == 2); //for sentinels
+	REQUIRE(pool.capacity() == 1024);
+
+	for (size_t i = 0; i < 300; ++i) {
+		REQUIRE(first.push(i));
+	}
+	for (size_t i = 0; i < 100; ++i) {
+		REQUIRE(second.push(i));
+	}
+	REQUIRE(first.used() == 301);
+	REQUIRE(second.used() == 101);
+	REQUIRE(pool.used() == 402);
+	REQUIRE(first.available() == 1024 - 402);
+
+	//the second queue can take the rest of the pool
+	size_t pushed = 0;
+	while (second.push(pushed)) {
+		++pushed;
+	}
+	REQUIRE(pushed == 1024 - 402 - 2); //the pool keeps two slots in reserve
+	REQUIRE(!first.push(0));
+	//no slot left for the sentinel of another queue
+	REQUIRE_THROWS_AS(Queue{pool}, const std::bad_alloc&);
+	REQUIRE(pool.used() == 1024 - 2);
+
+	size_t value;
+	while (second.pop(value)) {}
+	REQUIRE(second.used() == 1);
+	REQUIRE(first.push(300));
+	for (size_t i = 0; i <= 300; ++i) {
+		REQUIRE(first.pop(value));
+		REQUIRE(value == i);
+	}
+	REQUIRE(pool.used() == 2);
+}
+
+TEST_CASE("bitmap takes and releases a word at once") {
+	lockfree::memPool::Bitmap bitmap(256);
+	size_t out[64];
+	REQUIRE(bitmap.acquire(10, 64, out) == 64); //the rest of the word cannot be taken by one operation
+	REQUIRE(bitmap.acquire(0, 4, out) == 4);
+	REQUIRE(out[0] == 64);
+	REQUIRE(out[3] == 67);
+	bitmap.release(out, 4);
+	REQUIRE(!bitmap.test(64));
+
+	std::set<size_t> taken;
+	size_t count;
+	while ((count = bitmap.acquire(taken.size(), 64, out)) != 0) {
+		taken.insert(out, out + count);
+	}
+	REQUIRE(taken.size() == 256 - 64);
+	REQUIRE(bitmap.acquire(0) == lockfree::memPool::Bitmap::npos);
+}
+
+TEST_CASE("pool allocates and releases slots in bulk") {
+	using Queue = lockfree::memPool::Queue<size_t, 2048, policy::SizeTracking>;
+	Queue::Pool pool(1024);
+	size_t slots[64];
+	size_t count = pool.allocate_n(64, slots);
+	REQUIRE(count > 0);
+	REQUIRE(pool.used() == count);
+	std::set<size_t> unique(slots, slots + count);
+	REQUIRE(unique.size() == count);
+
+	pool.deallocate_n(slots, count);
+	REQUIRE(pool.used() == 0);
+
+	//the bulk allocation keeps the reserve of the pool too
+	size_t total = 0;
+	while ((count = pool.allocate_n(64, slots)) != 0) {
+		total += count;
+	}
+	REQUIRE(total == 1022);
+}
+
+template <typename Hint>
+void hintPolicyTest() {
+	using Queue = lockfree::memPool::Queue<size_t, 256, Hint, policy::SizeTracking>;
+	const size_t repeat = 8000;
+	Queue queue;
+	std::atomic<size_t> sum(0);
+	std::thread workers[4];
+	for (size_t i = 0; i < 4; ++i) {
+		workers[i] = std::thread(churnFn<Queue>, &queue, i * repeat / 4, (i + 1) * repeat / 4, &sum);
+	}
+	for (int i = 0; i < 4; ++i) {
+		workers[i].join();
+	}
+	REQUIRE(sum == repeat * (repeat - 1) / 2);
+	REQUIRE(queue.used() == 1);
+
+	//every hint finds the whole pool
+	size_t pushed = 0;
+	while (queue.push(pushed)) {
+		++pushed;
+	}
+	REQUIRE(pushed == 253);
+}
+
+TEST_CASE("every hint policy finds free slots") {
+	hintPolicyTest<policy::SequentialHint>();
+	hintPolicyTest<policy::RandomHint>();
+	hintPolicyTest<policy::AffineHint<>>();
+	hintPolicyTest<policy::AffineHint<3>>();
+	hintPolicyTest<policy::LastFreedHint>();
+	hintPolicyTest<policy::NumaHint<>>();
+	hintPolicyTest<policy::NumaHint<policy::Placement::firstTouch>>();
+}
+
+TEST_CASE("affine hint allocates in the home region first") {
+	using Hint = policy::AffineHint<4>;
+	using Pool = lockfree::memPool::Queue<size_t, 1024, Hint>::Pool;
+	Pool pool(1024);
+	size_t home = Hint::State::home(lockfree::threadIndex(), 1024);
+	REQUIRE(home % 256 == 0);
+
+	//freed slot is taken again
+	size_t first = pool.allocate();
+	REQUIRE(first == home);
+	pool.deallocate(first);
+	REQUIRE(pool.allocate() == home);
+
+	for (size_t i = 1; i < 256; ++i) {
+		REQUIRE(pool.allocate() == home + i);
+	}
+	//the region is full, the next one is used
+	REQUIRE(pool.allocate() == (home + 256) % 1024);
+}
+
+TEST_CASE("sharded counter sums its cells") {
+	lockfree::ShardedCounter<4> exact;
+	lockfree::ShardedCounter<4, 16> approximate;
+	std::thread workers[6];
+	for (auto &worker : workers) {
+		worker = std::thread([&exact, &approximate] {
+			for (int i = 0; i < 1000; ++i) {
+				exact.add(3);
+				exact.add(-1);
+				approximate.add(2);
+			}
+		});
+	}
+	for (auto &worker : workers) {
+		worker.join();
+	}
+	exact.add(-4);
+	REQUIRE(exact.load() == 11996);
+	REQUIRE(approximate.exact() == 12000);
+	REQUIRE(approximate.load() <= 12000);
+	REQUIRE(approximate.load() + 4 * 16 > 12000);
+}
+
+TEST_CASE("sharded size tracking counts pool and queues") {
+	using Queue = lockfree::memPool::Queue<size_t, 256, policy::ShardedSize<8>>;
+	Queue::Pool pool(256);
+	Queue first(pool);
+	Queue second(pool);
+	size_t pushed = 0;
+	while (first.push(pushed)) {
+		if (++pushed % 4 == 0 && !second.push(pushed))
+			break;
+	}
+	//no reserve is kept, the full bitmap stops the allocation
+	REQUIRE(pool.used() == 256);
+	REQUIRE(pool.available() == 0);
+	REQUIRE(first.used() + second.used() == 256);
+	REQUIRE(!second.push(0));
+
+	size_t value;
+	REQUIRE(first.pop(value));
+	REQUIRE(pool.available() == 1);
+	REQUIRE(second.push(0));
+}
+
+template <typename Layout>
+void layoutTest() {
+	const size_t size = 64 * 64 * 3 + 128;
+	lockfree::memPool::BasicBitmap<Layout> bitmap(size);
+	std::set<size_t> taken;
+	for (size_t i = 0; i < size; ++i) {
+		taken.insert(bitmap.acquire(i * 5));
+	}
+	REQUIRE(taken.size() == size);
+	REQUIRE(*taken.rbegin() == size - 1);
+	REQUIRE(bitmap.acquire(0) == lockfree::memPool::Bitmap::npos);
+	bitmap.release(size - 1);
+	REQUIRE(bitmap.acquire(0) == size - 1);
+}
+
+TEST_CASE("bitmap layouts keep all words apart") {
+	layoutTest<policy::PackedFlags>();
+	layoutTest<policy::PaddedFlags<>>();
+	layoutTest<policy::PaddedFlags<3>>();
+	layoutTest<policy::InterleavedFlags>();
+
+	using Queue = lockfree::memPool::Queue<size_t, 1024, policy::InterleavedFlags>;
+	Queue queue;
+	size_t pushed = 0;
+	while (queue.push(pushed)) {
+		++pushed;
+	}
+	REQUIRE(pushed == 1023);
+}
+
+TEST_CASE("fixed pool allocates objects for containers") {
+	using lockfree::memPool::FixedPool;
+	FixedPool<int, policy::SizeTracking> pool(64);
+	std::list<int, FixedPool<int, policy::SizeTracking>> list(pool);
+	for (int i = 0; i < 40; ++i) {
+		list.push_back(i);
+	}
+	REQUIRE(list.size() == 40);
+
+	//nodes of the list are in the pool of the rebound allocator
+	REQUIRE(list.get_allocator() == pool);
+	REQUIRE(pool.slots().used() == 0);
+	list.clear();
+	for (int i = 0; i < 62; ++i) {
+		list.push_back(i);
+	}
+	REQUIRE_THROWS_AS(list.push_back(62), const std::bad_alloc&);
+	REQUIRE(list.size() == 62);
+
+	//other pool is not equal
+	FixedPool<int, policy::SizeTracking> other(64);
+	REQUIRE(other != pool);
+
+	//full pool throws, the reserve of SizeTracking is kept
+	std::vector<int *> taken;
+	REQUIRE_THROWS_AS([&] {
+		while (true) {
+			taken.push_back(pool.allocate(1));
+		}
+	}(), const std::bad_alloc&);
+	REQUIRE(taken.size() == 62);
+	for (int *p : taken) {
+		pool.deallocate(p, 1);
+	}
+	REQUIRE(pool.slots().used() == 0);
+}
+
+TEST_CASE("fixed resource serves small blocks from the pool") {
+	using lockfree::memPool::FixedPool;
+	using lockfree::memPool::FixedResource;
+	struct Block {
+		alignas(16) char bytes[64];
+	};
+	FixedResource<Block> resource(FixedPool<Block>(64));
+	auto& slots = resource.pool().slots();
+
+	void *small = resource.allocate(8);
+	REQUIRE(slots.contains(small));
+	void *big = resource.allocate(4096);
+	REQUIRE(!slots.contains(big));
+	resource.deallocate(big, 4096);
+	resource.deallocate(small, 8);
+
+	std::pmr::map<int, int> map(&resource);
+	for (int i = 0; i < 100; ++i) {
+		map[i] = i;
+	}
+	REQUIRE(map.size() == 100);
+	REQUIRE(map[50] == 50);
+
+	//nodes over the size of the pool came from upstream
+	map.clear();
+
+	//all blocks are back in the pool, which does not grow
+	std::vector<void *> blocks;
+	for (int i = 0; i < 64; ++i) {
+		blocks.push_back(resource.allocate(16));
+		REQUIRE(slots.contains(blocks.back()));
+	}
+	void *overflow = resource.allocate(16);
+	REQUIRE(!slots.contains(overflow));
+	resource.deallocate(overflow, 16);
+	for (void *p : blocks) {
+		resource.deallocate(p, 16);
+	}
+}
+
+TEST_CASE("vector scan finds the first word with a free bit") {
+	namespace scan = lockfree::memPool::scan;
+	const size_t count = 100;
+	std::atomic<size_t> words[count];
+	for (auto& word : words) {
+		word = scan::full;
+	}
+	const scan::Isa isas[] = {scan::Isa::scalar, scan::Isa::sse42, scan::Isa::avx2};
+	for (size_t free = 0; free <= count; ++free) {
+		if (free < count)
+			words[free] = scan::full & ~(size_t(1) << (free % 64));
+		for (size_t from = 0; from <= count; from += 7) {
+			size_t expected = free >= from ? free : count;
+			for (scan::Isa isa : isas) {
+				scan::use(isa);
+				REQUIRE(scan::find(words, from, count) == expected);
+			}
+		}
+		if (free < count)
+			words[free] = scan::full;
+	}
+
+	//the bitmap hands out all bits by every implementation
+	for (scan::Isa isa : isas) {
+		scan::use(isa);
+		lockfree::memPool::Bitmap bitmap(64 * 40);
+		std::set<size_t> taken;
+		for (size_t i = 0; i < bitmap.size(); ++i) {
+			taken.insert(bitmap.acquire(i * 7));
+		}
+		REQUIRE(taken.size() == bitmap.size());
+		REQUIRE(bitmap.acquire(0) == lockfree::memPool::Bitmap::npos);
+	}
+	scan::use(scan::best());
+}
+
+TEST_CASE("push_wait sleeps until a slot is freed") {
+	using Queue = lockfree::memPool::Queue<size_t, 64>;
+	Queue queue;
+	size_t pushed = 0;
+	while (queue.push(pushed)) {
+		++pushed;
+	}
+
+	std::thread producer([&queue] {
+		queue.push_wait(1000);
+	});
+	while (queue.pool().released().waiting() == 0) {
+		std::this_thread::yield();
+	}
+	size_t value;
+	REQUIRE(queue.pop(value));
+	REQUIRE(value == 0);
+	producer.join();
+
+	size_t last = 0;
+	while (queue.pop(value)) {
+		last = value;
+	}
+	REQUIRE(last == 1000);
+	REQUIRE(queue.pool().released().waiting() == 0);
+}
+
+template <typename Queue>
+void pushWaitTest() {
+	const size_t repeat = 8000;
+	Queue queue;
+	std::atomic<size_t> sum(0);
+	std::atomic<size_t> popped(0);
+	std::vector<std::thread> producers;
+	for (size_t t = 0; t < 4; ++t) {
+		producers.emplace_back([&queue, t, repeat] {
+			for (size_t i = t * repeat / 4; i < (t + 1) * repeat / 4; ++i) {
+				queue.push_wait(i);
+			}
+		});
+	}
+	std::thread consumer([&queue, &sum, &popped, repeat] {
+		size_t value;
+		while (popped < repeat) {
+			if (queue.pop(value)) {
+				sum += value;
+				++popped;
+			}
+		}
+	});
+	for (auto& producer : producers) {
+		producer.join();
+	}
+	consumer.join();
+	REQUIRE(sum == repeat * (repeat - 1) / 2);
+	REQUIRE(queue.empty());
+}
+
+TEST_CASE("producers wait for a full pool") {
+	pushWaitTest<lockfree::memPool::Queue<size_t, 64>>();
+	pushWaitTest<lockfree::memPool::Queue<size_t, 64, policy::Magazines<8>, policy::SizeTracking>>();
+	pushWaitTest<lockfree::memPool::Queue<size_t, 128, policy::HazardPointers<>>>();
+}
+
+TEST_CASE("pool statistics count allocations and probes") {
+	using Queue = lockfree::memPool::Queue<size_t, 256, policy::Statistics<>>;
+	Queue queue;
+	for (size_t i = 0; i < 200; ++i) {
+		REQUIRE(queue.push(i));
+	}
+	size_t value;
+	for (size_t i = 0; i < 200; ++i) {
+		REQUIRE(queue.pop(value));
+	}
+	auto stats = queue.pool().statistics();
+	REQUIRE(stats.allocations == 201);
+	REQUIRE(stats.releases == 200);
+	REQUIRE(stats.used() == 1);
+	REQUIRE(stats.failures == 0);
+	REQUIRE(stats.collisions == 0);
+	//sampled every 64 allocations
+	REQUIRE(stats.peak >= 192);
+	REQUIRE(stats.peak <= 201);
+	size_t probed = 0;
+	for (size_t count : stats.probes) {
+		probed += count;
+	}
+	REQUIRE(probed == 201);
+	REQUIRE(stats.probes[0] == 0);
+
+	while (queue.push(0)) {
+	}
+	stats = queue.pool().statistics();
+	REQUIRE(stats.failures == 1);
+	REQUIRE(stats.peak == 256);
+
+	//threads above the limit share a cell
+	using Pool = lockfree::memPool::SlotPool<size_t, policy::Statistics<1>, policy::Magazines<8>>;
+	Pool pool(1024);
+	std::thread workers[4];
+	for (auto& worker : workers) {
+		worker = std::thread([&pool] {
+			for (size_t i = 0; i < 1000; ++i) {
+				pool.deallocate(pool.allocate());
+			}
+		});
+	}
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	auto shared = pool.statistics();
+	REQUIRE(shared.allocations == 4000);
+	REQUIRE(shared.releases == 4000);
+	REQUIRE(shared.probes[0] > 0);
+
+	REQUIRE(policy::Statistics<>::bucket(1) == 1);
+	REQUIRE(policy::Statistics<>::bucket(4) == 3);
+	REQUIRE(policy::Statistics<>::bucket(5) == 4);
+	REQUIRE(policy::Statistics<>::bucket(64) == 7);
+	REQUIRE(policy::Statistics<>::bucket(1000) == 8);
+}
+
+// counts living instances
+struct Counted {
+	static std::atomic<int> living;
+	size_t value;
+
+	Counted(size_t v = 0) : value(v) {
+		++living;
+	}
+
+	Counted(const Counted& other) : value(other.value) {
+		++living;
+	}
+
+	Counted& operator=(const Counted&) = default;
+
+	~Counted() {
+		--living;
+	}
+};
+
+std::atomic<int> Counted::living(0);
+
+TEST_CASE("queue teardown destroys every value once") {
+	{
+		lockfree::memPool::Queue<Counted, 1024, policy::Magazines<16>> queue;
+		for (size_t i = 0; i < 700; ++i) {
+			REQUIRE(queue.push(Counted(i)));
+		}
+		Counted out;
+		for (size_t i = 0; i < 300; ++i) {
+			REQUIRE(queue.pop(out));
+		}
+	}
+	REQUIRE(Counted::living == 0);
+
+	using Queue = lockfree::memPool::Queue<Counted, 1024, policy::SizeTracking>;
+	{
+		Queue::Pool pool(1024);
+		{
+			Queue first(pool);
+			Queue second(pool);
+			for (size_t i = 0; i < 400; ++i) {
+				REQUIRE(first.push(Counted(i)));
+				REQUIRE(second.push(Counted(i)));
+			}
+		}
+		//the queues returned their nodes in bulk
+		REQUIRE(pool.used() == 0);
+		REQUIRE(Counted::living == 0);
+
+		Queue third(pool);
+		for (size_t i = 0; i < 1000; ++i) {
+			REQUIRE(third.push(Counted(i)));
+		}
+		REQUIRE(pool.used() == 1001);
+	}
+	REQUIRE(Counted::living == 0);
+}
+
+TEST_CASE("numa hint places slabs by nodes") {
+	namespace numa = lockfree::memPool::numa;
+	REQUIRE(numa::nodes() >= 1);
+	REQUIRE(numa::node() < numa::nodes());
+
+	using Queue = lockfree::memPool::Queue<size_t, 4096, policy::NumaHint<>, policy::Growth<16384>>;
+	Queue queue;
+	for (size_t i = 0; i < 10000; ++i) {
+		REQUIRE(queue.push(i));
+	}
+	//touched memory is on some node, if the kernel knows NUMA at all
+	size_t node = numa::nodeOf(queue.pool().address(0));
+	REQUIRE((node == numa::unknown || node < numa::nodes()));
+
+	policy::NumaHint<>::State state;
+	REQUIRE(state.nodeOf(0, 4096) == 0);
+	REQUIRE(state.nodeOf(4095, 4096) == numa::nodes() - 1);
+}
+
+// counts copies made of it
+struct Copied {
+	static std::atomic<int> copies;
+	std::string text;
+
+	Copied() = default;
+
+	explicit Copied(std::string t) : text(std::move(t)) {
+	}
+
+	Copied(const Copied& other) : text(other.text) {
+		++copies;
+	}
+
+	Copied(Copied&&) = default;
+
+	Copied& operator=(const Copied& other) {
+		text = other.text;
+		++copies;
+		return *this;
+	}
+
+	Copied& operator=(Copied&&) = default;
+};
+
+std::atomic<int> Copied::copies(0);
+
+TEST_CASE("values are moved through the queue") {
+	lockfree::memPool::Queue<Copied, 128> queue;
+	Copied value("first");
+	REQUIRE(queue.push(std::move(value)));
+	REQUIRE(queue.emplace(std::string(1024, 'x')));
+	Copied out;
+	REQUIRE(queue.pop(out));
+	REQUIRE(out.text == "first");
+	REQUIRE(queue.pop(out));
+	REQUIRE(out.text.size() == 1024);
+	REQUIRE(Copied::copies == 0);
+
+	//a push of an lvalue copies once
+	REQUIRE(queue.push(out));
+	REQUIRE(Copied::copies == 1);
+}
+
+TEST_CASE("move only values are queued") {
+	using Queue = lockfree::memPool::Queue<std::unique_ptr<size_t>, 128, policy::HazardPointers<>>;
+	Queue queue;
+	for (size_t i = 0; i < 100; ++i) {
+		if (i % 2)
+			REQUIRE(queue.push(std::make_unique<size_t>(i)));
+		else
+			REQUIRE(queue.emplace(new size_t(i)));
+	}
+	std::unique_ptr<size_t> out;
+	for (size_t i = 0; i < 100; ++i) {
+		REQUIRE(queue.pop(out));
+		REQUIRE(*out == i);
+	}
+	REQUIRE(!queue.pop(out));
+
+	//full pool leaves the value to the caller
+	lockfree::memPool::Queue<std::unique_ptr<size_t>, 64> small;
+	auto value = std::make_unique<size_t>(7);
+	while (small.emplace(std::move(value))) {
+		value = std::make_unique<size_t>(7);
+	}
+	REQUIRE(value);
+	REQUIRE(*value == 7);
+	std::unique_ptr<size_t> first;
+	REQUIRE(small.pop(first));
+	small.push_wait(std::move(value));
+	REQUIRE(!value);
+}
+
+TEST_CASE("move only values pass between threads") {
+	//default policies reclaim the nodes of move only values safely
+	using Queue = lockfree::memPool::Queue<std::unique_ptr<size_t>, 128>;
+	static_assert(Queue::hazardPointers, "values, which are not trivially copyable, need deferred reclamation");
+	const size_t repeat = 30000, producers = 2, consumers = 2;
+	Queue queue;
+	std::atomic<size_t> sum(0), popped(0);
+	std::vector<std::thread> threads;
+	for (size_t p = 0; p < producers; ++p) {
+		threads.emplace_back([&queue, p, repeat] {
+			for (size_t i = p; i < repeat; i += producers) {
+				auto value = std::make_unique<size_t>(i);
+				while (!queue.push(std::move(value))) {
+					value = std::make_unique<size_t>(i);
+				}
+			}
+		});
+	}
+	for (size_t c = 0; c < consumers; ++c) {
+		threads.emplace_back([&queue, &sum, &popped, repeat] {
+			std::unique_ptr<size_t> out;
+			while (popped < repeat) {
+				if (queue.pop(out)) {
+					sum += *out;
+					++popped;
+				}
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	REQUIRE(popped == repeat);
+	REQUIRE(sum == repeat * (repeat - 1) / 2);
+}
+
+// has no default constructor, counts living instances
+struct Token {
+	static std::atomic<int> living;
+	size_t value;
+
+	explicit Token(size_t v) : value(v) {
+		++living;
+	}
+
+	Token(const Token& other) : value(other.value) {
+		++living;
+	}
+
+	Token& operator=(const Token&) = default;
+
+	~Token() {
+		--living;
+	}
+};
+
+std::atomic<int> Token::living(0);
+
+template <typename Queue>
+void tokenTest(Queue& queue) {
+	for (size_t i = 0; i < 50; ++i) {
+		REQUIRE(queue.push(Token(i)));
+	}
+	REQUIRE(Token::living == 50);
+	Token out(0);
+	for (size_t i = 0; i < 20; ++i) {
+		REQUIRE(queue.pop(out));
+		REQUIRE(out.value == i);
+	}
+	//the popped values are destroyed in their nodes, the sentinel holds none
+	REQUIRE(Token::living == 31);
+}
+
+TEST_CASE("queues hold values without a default constructor") {
+	{
+		lockfree::memPool::Queue<Token, 64> queue;
+		REQUIRE(Token::living == 0);
+		tokenTest(queue);
+		REQUIRE(queue.emplace(size_t(7)));
+	}
+	REQUIRE(Token::living == 0);
+	{
+		using Queue = lockfree::memPool::Queue<Token, 64, policy::Epochs, policy::SizeTracking>;
+		Queue::Pool pool(64);
+		{
+			Queue queue(pool);
+			tokenTest(queue);
+		}
+		REQUIRE(Token::living == 0);
+		REQUIRE(pool.used() == 0);
+	}
+	{
+		lockfree::sharedPtr::Queue<Token> queue;
+		tokenTest(queue);
+	}
+	REQUIRE(Token::living == 0);
+	{
+		lockfree::sharedPtr::Queue<Token, lockfree::sharedPtr::Epochs> queue;
+		tokenTest(queue);
+	}
+	REQUIRE(Token::living == 0);
+}
+
+template <typename Queue>
+void bulkProducerFn(Queue *queue, size_t producer, size_t batches) {
+	std::vector<size_t> batch(16);
+	for (size_t b = 0; b < batches; ++b) {
+		for (size_t i = 0; i < batch.size(); ++i) {
+			batch[i] = (producer << 32) | (b * batch.size() + i);
+		}
+		size_t pushed = 0;
+		while (pushed < batch.size()) {
+			pushed += queue->push_bulk(batch.begin() + pushed, batch.end());
+		}
+	}
+}
+
+//producers push batches, the items of every producer are popped in order
+template <typename Queue>
+void bulkOrderTest(Queue& queue) {
+	const size_t producers = 3, batches = 200, items = producers * batches * 16;
+	std::thread threads[producers];
+	for (size_t p = 0; p < producers; ++p) {
+		threads[p] = std::thread(bulkProducerFn<Queue>, &queue, p, batches);
+	}
+	size_t next[producers] = {};
+	size_t value;
+	for (size_t popped = 0; popped < items;) {
+		if (queue.pop(value)) {
+			REQUIRE((value & 0xFFFFFFFF) == next[value >> 32]++);
+			++popped;
+		}
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	REQUIRE(!queue.pop(value));
+}
+
+TEST_CASE("push_bulk links a whole batch at once") {
+	lockfree::memPool::Queue<size_t, 128, policy::SizeTracking> queue;
+	std::vector<size_t> values(100);
+	for (size_t i = 0; i < values.size(); ++i) {
+		values[i] = i;
+	}
+	REQUIRE(queue.push_bulk(values) == 100);
+	REQUIRE(queue.push_bulk(values.begin(), values.begin()) == 0);
+	REQUIRE(queue.used() == 101);
+	//full pool takes only the first items
+	size_t pushed = queue.push_bulk(values);
+	REQUIRE(pushed > 0);
+	REQUIRE(pushed <= 27);
+	REQUIRE(!queue.push(0));
+	size_t value;
+	for (size_t i = 0; i < 100 + pushed; ++i) {
+		REQUIRE(queue.pop(value));
+		REQUIRE(value == i % 100);
+	}
+	REQUIRE(queue.empty());
+
+	lockfree::memPool::Queue<size_t, 256, policy::Handles> handles;
+	bulkOrderTest(handles);
+	lockfree::memPool::Queue<size_t, 256, policy::HazardPointers<>> hazard;
+	bulkOrderTest(hazard);
+	lockfree::sharedPtr::Queue<size_t> counted;
+	bulkOrderTest(counted);
+	lockfree::sharedPtr::Queue<size_t, lockfree::sharedPtr::Epochs> epochs;
+	bulkOrderTest(epochs);
+}
+
+//consumers pop batches, every item is popped once
+template <typename Queue>
+void popBulkTest(Queue& queue) {
+	const size_t items = 10000, consumers = 3;
+	std::vector<size_t> popped[consumers];
+	std::atomic<size_t> total(0);
+	std::atomic<bool> overflow(false);
+	std::thread threads[consumers];
+	for (size_t c = 0; c < consumers; ++c) {
+		threads[c] = std::thread([&queue, &total, &overflow, &popped, c, items] {
+			size_t batch = 1 + c * 31;
+			while (total < items) {
+				size_t count = queue.pop_bulk(std::back_inserter(popped[c]), batch);
+				if (count > batch)
+					overflow = true;
+				total += count;
+			}
+		});
+	}
+	for (size_t i = 0; i < items; ++i) {
+		while (!queue.push(i)) {}
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	REQUIRE(!overflow);
+	std::vector<size_t> all;
+	for (auto& values : popped) {
+		//every consumer gets the items in order
+		REQUIRE(std::is_sorted(values.begin(), values.end()));
+		all.insert(all.end(), values.begin(), values.end());
+	}
+	std::sort(all.begin(), all.end());
+	REQUIRE(all.size() == items);
+	for (size_t i = 0; i < items; ++i) {
+		REQUIRE(all[i] == i);
+	}
+}
+
+TEST_CASE("pop_bulk claims many nodes at once") {
+	//Token needs deferred reclamation, so the retired nodes are not counted
+	using Queue = lockfree::memPool::Queue<Token, 128>;
+	{
+		Queue queue;
+		for (size_t i = 0; i < 100; ++i) {
+			REQUIRE(queue.emplace(i));
+		}
+		std::vector<Token> out;
+		REQUIRE(queue.pop_bulk(std::back_inserter(out), 0) == 0);
+		REQUIRE(queue.pop_bulk(std::back_inserter(out), 70) == 70);
+		REQUIRE(queue.pop_bulk(std::back_inserter(out), 70) == 30);
+		REQUIRE(queue.pop_bulk(std::back_inserter(out), 70) == 0);
+		REQUIRE(out.size() == 100);
+		for (size_t i = 0; i < out.size(); ++i) {
+			REQUIRE(out[i].value == i);
+		}
+		REQUIRE(Token::living == 100);
+	}
+	REQUIRE(Token::living == 0);
+
+	lockfree::memPool::Queue<size_t, 256, policy::SizeTracking> immediate;
+	popBulkTest(immediate);
+	REQUIRE(immediate.used() == 1);
+	lockfree::memPool::Queue<size_t, 256, policy::Handles> handles;
+	popBulkTest(handles);
+	lockfree::memPool::Queue<size_t, 256, policy::HazardPointers<>> hazard;
+	popBulkTest(hazard);
+	lockfree::memPool::Queue<size_t, 256, policy::Epochs> epochs;
+	popBulkTest(epochs);
+	lockfree::sharedPtr::Queue<size_t> counted;
+	popBulkTest(counted);
+	lockfree::sharedPtr::Queue<size_t, lockfree::sharedPtr::Epochs> sharedEpochs;
+	popBulkTest(sharedEpochs);
+}
+
+template <typename Queue>
+void popWaitTest() {
+	const size_t repeat = 8000, consumers = 3;
+	Queue queue;
+	std::atomic<size_t> sum(0);
+
+	//a consumer of an empty queue sleeps until a push
+	std::thread sleeper([&queue, &sum] {
+		size_t value;
+		queue.pop_wait(value);
+		sum += value;
+	});
+	while (queue.waiting() == 0) {
+		std::this_thread::yield();
+	}
+	REQUIRE(queue.push(7));
+	sleeper.join();
+	REQUIRE(sum == 7);
+	REQUIRE(queue.waiting() == 0);
+
+	sum = 0;
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < consumers; ++t) {
+		threads.emplace_back([&queue, &sum, repeat] {
+			size_t value;
+			for (size_t i = 0; i < repeat / consumers; ++i) {
+				queue.pop_wait(value);
+				sum += value;
+			}
+		});
+	}
+	std::vector<size_t> batch;
+	for (size_t i = 0; i < repeat - repeat % consumers; ++i) {
+		//pushed one by one and in batches
+		if (i % 2) {
+			while (!queue.push(i)) {}
+			continue;
+		}
+		batch.assign(1, i);
+		while (!queue.push_bulk(batch)) {}
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	size_t items = repeat - repeat % consumers;
+	REQUIRE(sum == items * (items - 1) / 2);
+	size_t value;
+	REQUIRE(!queue.pop(value));
+	REQUIRE(queue.waiting() == 0);
+}
+
+TEST_CASE("consumers wait for an empty queue") {
+	popWaitTest<lockfree::memPool::Queue<size_t, 256>>();
+	popWaitTest<lockfree::memPool::Queue<size_t, 256, policy::Epochs>>();
+	popWaitTest<lockfree::sharedPtr::Queue<size_t>>();
+	popWaitTest<lockfree::sharedPtr::Queue<size_t, lockfree::sharedPtr::Epochs>>();
+}